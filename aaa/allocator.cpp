@@ -5,41 +5,479 @@
 //  Created by Antony Searle on 15/1/2025.
 //
 
+#include <algorithm>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__)
+#include <linux/mempolicy.h>
+#include <sys/syscall.h>
+#endif
+
 #include "allocator.hpp"
+#include "atomic.hpp"
 
 namespace aaa {
     
-    void* _arena_allocate_cold(size_t n) {
+    namespace {
+        
+        unsigned char* _arena_align(unsigned char* p, size_t alignment) {
+            return (unsigned char*)(((uintptr_t)p + (alignment - 1)) & -(uintptr_t)alignment);
+        }
+        
+        void _arena_free_lists_clear() {
+            for (_arena_free_t*& head : _tl_arena_free)
+                head = nullptr;
+        }
+        
+    } // namespace
+    
+    // Slab pool
+    //
+    // Slabs retired by arena_advance go to a global pool, bucketed by the
+    // floor of their log2 size, so that a thread growing in a later frame
+    // draws one back instead of calling malloc and faulting in fresh pages.
+    //
+    // Each bucket is a Treiber stack linked through the predecessor field.
+    // Pushing is the usual CAS loop.  Popping exchanges the whole stack for
+    // null, which cannot suffer ABA, and puts the remainder back by a CAS
+    // from null; a concurrent draw may see a spurious miss, which costs
+    // only a malloc.  Only if slabs were pushed in the meantime must we
+    // walk to the bottom of those, and put them on top.  Either way the
+    // stack stays ordered from the most to the least recently pooled.
+    //
+    // Slabs that nobody draws for a number of frames are madvised
+    // MADV_FREE, so the kernel may take their pages back under pressure
+    // while we keep the mapping.  The page holding the header is kept so
+    // that the slab stays linked.  Since the stack is ordered, the advised
+    // slabs are a suffix of it, and each tick walks a bucket only down to
+    // the first advised slab: past the slabs pooled in the last few
+    // frames, to the ones it newly advises.
+    //
+    // Slabs backed by huge pages or bound to a NUMA node are pooled apart
+    // from the rest, and only drawn by threads that asked for the same.
+    // Every slab in a thread's chain shares the thread's backing.
+    
+    namespace {
+        
+        constexpr int ARENA_POOL_BUCKETS = 64;
+        constexpr int ARENA_POOL_CLASSES = (ARENA_NUMA_NODES + 1) * 2;
+        constexpr uint64_t ARENA_POOL_ADVISED = (uint64_t)1 << 63;
+        
+        Atomic<_arena_t*> _arena_pool[ARENA_POOL_CLASSES][ARENA_POOL_BUCKETS];
+        thread_local arena_options _tl_arena_options;
+        thread_local Atomic<_arena_t*>* _tl_arena_pool = _arena_pool[0];
+        Atomic<uint64_t> _arena_pool_frame{0};
+        Atomic<uint64_t> _arena_pool_hits{0};
+        Atomic<uint64_t> _arena_pool_misses{0};
+        Atomic<uint64_t> _arena_pool_advised{0};
+        Atomic<uint64_t> _arena_pool_bytes{0};
+        
+        int _log2_floor(size_t n) {
+            return 63 - __builtin_clzll(n);
+        }
+        
+        int _log2_ceil(size_t n) {
+            return (n > 1) ? (64 - __builtin_clzll(n - 1)) : 0;
+        }
+        
+        size_t _arena_size(const _arena_t* p) {
+            return p->end - (const unsigned char*)p;
+        }
+        
+        void _arena_pool_push(Atomic<_arena_t*>& bucket, _arena_t* p) {
+            _arena_t* expected = bucket.load(Ordering::RELAXED);
+            do {
+                p->predecessor = expected;
+            } while (!bucket.compare_exchange_weak(expected,
+                                                   p,
+                                                   Ordering::RELEASE,
+                                                   Ordering::RELAXED));
+        }
+        
+        // Put back the rest of a stack we took by exchange, under anything
+        // pushed since, which is more recent
+        void _arena_pool_restore(Atomic<_arena_t*>& bucket, _arena_t* first) {
+            _arena_t* expected = nullptr;
+            while (!bucket.compare_exchange_weak(expected,
+                                                 first,
+                                                 Ordering::RELEASE,
+                                                 Ordering::RELAXED)) {
+                if (_arena_t* newer = bucket.exchange(nullptr, Ordering::ACQUIRE)) {
+                    _arena_t* last = newer;
+                    while (last->predecessor)
+                        last = last->predecessor;
+                    last->predecessor = first;
+                    first = newer;
+                }
+                expected = nullptr;
+            }
+        }
+        
+        void _arena_pool_return(_arena_t* p) {
+            size_t m = _arena_size(p);
+            p->pooled = _arena_pool_frame.load(Ordering::RELAXED);
+            _arena_pool_bytes.add_fetch(m, Ordering::RELAXED);
+            _arena_pool_push(_tl_arena_pool[_log2_floor(m)], p);
+        }
+        
+#if defined(__linux__)
+        
+        constexpr size_t HUGE_PAGE_SIZE = 2 << 20;
+        
+        // Map at least n bytes with the calling thread's backing, updating
+        // n to what was mapped, or return null to fall back to malloc
+        void* _arena_map(size_t& n) {
+            const arena_options& options = _tl_arena_options;
+            void* p = MAP_FAILED;
+            if (options.huge_pages) {
+                n = (n + HUGE_PAGE_SIZE - 1) & -HUGE_PAGE_SIZE;
+                p = mmap(nullptr, n, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+                if (p == MAP_FAILED) {
+                    // No huge pages reserved; map a huge-page-aligned range
+                    // and hint that it should get transparent ones
+                    size_t m = n + HUGE_PAGE_SIZE;
+                    void* q = mmap(nullptr, m, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                    if (q == MAP_FAILED)
+                        return nullptr;
+                    unsigned char* a = (unsigned char*)q;
+                    unsigned char* b = _arena_align(a, HUGE_PAGE_SIZE);
+                    if (b != a)
+                        munmap(a, b - a);
+                    if (b + n != a + m)
+                        munmap(b + n, (a + m) - (b + n));
+                    p = b;
+                    (void) madvise(p, n, MADV_HUGEPAGE);
+                }
+            } else {
+                static const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+                n = (n + page - 1) & -page;
+                p = mmap(nullptr, n, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if (p == MAP_FAILED)
+                    return nullptr;
+            }
+            if (options.numa_node >= 0) {
+                // Before anything touches the pages.  Preferred rather than
+                // bound, so that a full node spills instead of failing
+                unsigned long mask = 1ul << options.numa_node;
+                (void) syscall(SYS_mbind, p, n, MPOL_PREFERRED, &mask, sizeof(mask) * 8, 0);
+            }
+            return p;
+        }
+        
+#else
+        
+        void* _arena_map(size_t&) {
+            return nullptr;
+        }
+        
+#endif
+        
+
+        // A slab of at least n bytes, with end set and nothing else.  We
+        // will take one a little larger, which only defers the next growth
+        _arena_t* _arena_slab_acquire(size_t n) {
+            Atomic<_arena_t*>* pool = _tl_arena_pool;
+            int k = _log2_ceil(n);
+            for (int j = k; (j != k + 3) && (j < ARENA_POOL_BUCKETS); ++j) {
+                if (!pool[j].load(Ordering::RELAXED))
+                    continue;
+                if (_arena_t* p = pool[j].exchange(nullptr, Ordering::ACQUIRE)) {
+                    if (_arena_t* rest = p->predecessor)
+                        _arena_pool_restore(pool[j], rest);
+                    _arena_pool_bytes.sub_fetch(_arena_size(p), Ordering::RELAXED);
+                    _arena_pool_hits.add_fetch(1, Ordering::RELAXED);
+                    return p;
+                }
+            }
+            _arena_pool_misses.add_fetch(1, Ordering::RELAXED);
+            _arena_t* p = nullptr;
+            if (_tl_arena_options.huge_pages || (_tl_arena_options.numa_node >= 0))
+                p = (_arena_t*)_arena_map(n);
+            if (!p)
+                p = (_arena_t*)malloc(n);
+            if (!p)
+                abort();
+            p->end = (unsigned char*)p + n;
+            return p;
+        }
+        
+        void _arena_slab_advise(_arena_t* p) {
+#if defined(MADV_FREE)
+            static const uintptr_t page = (uintptr_t)sysconf(_SC_PAGESIZE);
+            uintptr_t first = ((uintptr_t)p->data + page - 1) & -page;
+            uintptr_t last = (uintptr_t)p->end & -page;
+            if (first < last)
+                (void) madvise((void*)first, last - first, MADV_FREE);
+#endif
+        }
+        
+    } // namespace
+    
+    void arena_pool_tick(uint64_t decay_frames) {
+        uint64_t frame = _arena_pool_frame.add_fetch(1, Ordering::RELAXED);
+        for (auto& pool : _arena_pool) {
+            for (Atomic<_arena_t*>& bucket : pool) {
+                if (!bucket.load(Ordering::RELAXED))
+                    continue;
+                _arena_t* first = bucket.exchange(nullptr, Ordering::ACQUIRE);
+                if (!first)
+                    continue;
+                // Slabs below one old enough to advise were pooled no
+                // later than it was, so we advise them too, which keeps
+                // the advised slabs a suffix even if pushes raced a tick
+                bool stale = false;
+                for (_arena_t* p = first; p && !(p->pooled & ARENA_POOL_ADVISED); p = p->predecessor) {
+                    stale = stale || (p->pooled + decay_frames < frame);
+                    if (stale) {
+                        _arena_slab_advise(p);
+                        p->pooled |= ARENA_POOL_ADVISED;
+                        _arena_pool_advised.add_fetch(1, Ordering::RELAXED);
+                    }
+                }
+                _arena_pool_restore(bucket, first);
+            }
+        }
+    }
+    
+    arena_pool_statistics arena_pool_stats() {
+        return arena_pool_statistics{
+            .hits = _arena_pool_hits.load(Ordering::RELAXED),
+            .misses = _arena_pool_misses.load(Ordering::RELAXED),
+            .advised = _arena_pool_advised.load(Ordering::RELAXED),
+            .pooled_bytes = _arena_pool_bytes.load(Ordering::RELAXED),
+        };
+    }
+    
+    // Statistics
+    //
+    // The fast path is left alone.  Each thread publishes its counters to
+    // relaxed atomics on the slow path, at growth, advance and finalize;
+    // only the owning thread writes them, so it needs no read-modify-write.
+    // The bytes bumped in a slab are counted when the thread leaves the
+    // slab behind or rewinds it.  Live threads are found through a
+    // registry, and exiting threads fold their totals into a global record.
+    
+    namespace {
+        
+        struct _arena_statistics_t {
+            Atomic<uint64_t> bytes_bumped{0};
+            Atomic<uint64_t> growths{0};
+            Atomic<uint64_t> oversized{0};
+            Atomic<uint64_t> largest_request{0};
+            Atomic<uint64_t> last_frame_bytes{0};
+            Atomic<uint64_t> frame_high_water{0};
+            Atomic<uint64_t> wasted_tail_bytes{0};
+            Atomic<uint64_t> frames{0};
+            Atomic<uint64_t> reserved_bytes{0};
+            // owner only: bumped in slabs left behind this frame
+            uint64_t frame_bytes = 0;
+            _arena_statistics_t* next = nullptr;
+            _arena_statistics_t* prev = nullptr;
+        };
+        
+        thread_local _arena_statistics_t* _tl_arena_statistics = nullptr;
+        
+        std::mutex _arena_registry_mutex;
+        _arena_statistics_t* _arena_registry_head = nullptr;
+        arena_statistics _arena_retired_statistics = {};
+        
+        void _publish_add(Atomic<uint64_t>& a, uint64_t x) {
+            a.store(a.load(Ordering::RELAXED) + x, Ordering::RELAXED);
+        }
+        
+        void _publish_max(Atomic<uint64_t>& a, uint64_t x) {
+            if (a.load(Ordering::RELAXED) < x)
+                a.store(x, Ordering::RELAXED);
+        }
+        
+        // a slab is being left behind, or rewound
+        void _publish_bumped(_arena_statistics_t& stats, const _arena_t* p) {
+            uint64_t used = p->begin - p->data;
+            _publish_add(stats.bytes_bumped, used);
+            stats.frame_bytes += used;
+        }
+        
+        arena_statistics _snapshot(const _arena_statistics_t& stats) {
+            return arena_statistics{
+                .bytes_bumped = stats.bytes_bumped.load(Ordering::RELAXED),
+                .growths = stats.growths.load(Ordering::RELAXED),
+                .oversized = stats.oversized.load(Ordering::RELAXED),
+                .largest_request = stats.largest_request.load(Ordering::RELAXED),
+                .last_frame_bytes = stats.last_frame_bytes.load(Ordering::RELAXED),
+                .frame_high_water = stats.frame_high_water.load(Ordering::RELAXED),
+                .wasted_tail_bytes = stats.wasted_tail_bytes.load(Ordering::RELAXED),
+                .frames = stats.frames.load(Ordering::RELAXED),
+                .reserved_bytes = stats.reserved_bytes.load(Ordering::RELAXED),
+            };
+        }
+        
+        void _accumulate(arena_statistics& a, const arena_statistics& b) {
+            a.bytes_bumped += b.bytes_bumped;
+            a.growths += b.growths;
+            a.oversized += b.oversized;
+            a.largest_request = std::max(a.largest_request, b.largest_request);
+            a.last_frame_bytes += b.last_frame_bytes;
+            a.frame_high_water = std::max(a.frame_high_water, b.frame_high_water);
+            a.wasted_tail_bytes += b.wasted_tail_bytes;
+            a.frames += b.frames;
+            a.reserved_bytes += b.reserved_bytes;
+        }
+        
+    } // namespace
+    
+    arena_statistics arena_stats() {
+        assert(_tl_arena_statistics);
+        return _snapshot(*_tl_arena_statistics);
+    }
+    
+    std::vector<arena_statistics> arena_stats_per_thread() {
+        std::vector<arena_statistics> result;
+        std::unique_lock lock{_arena_registry_mutex};
+        for (const _arena_statistics_t* p = _arena_registry_head; p; p = p->next)
+            result.push_back(_snapshot(*p));
+        return result;
+    }
+    
+    arena_statistics arena_stats_total() {
+        std::unique_lock lock{_arena_registry_mutex};
+        arena_statistics result = _arena_retired_statistics;
+        for (const _arena_statistics_t* p = _arena_registry_head; p; p = p->next)
+            _accumulate(result, _snapshot(*p));
+        return result;
+    }
+    
+    void* _arena_allocate_cold(size_t n, size_t alignment) {
         _arena_t* p = _tl_arena;
         assert(p);
         size_t m = (p->end - (unsigned char*) p) << 1;
-        _arena_t* q = (_arena_t*)malloc(m);
-        q->begin = q->data + n;
-        q->end = (unsigned char*)q + m;
+        // malloc aligns data[] to 16 bytes; beyond that we may need to pad
+        size_t need = sizeof(_arena_t) + n + ((alignment > 16) ? (alignment - 1) : 0);
+        if (need > (m >> 2)) {
+            // Too big to be worth growing for.  Give the request a slab of
+            // its own beneath the current one, which keeps its free tail,
+            // and which arena_advance will retire along with the rest
+            _arena_t* q = _arena_slab_acquire(need);
+            q->begin = q->end;
+            q->predecessor = p->predecessor;
+            p->predecessor = q;
+            _arena_statistics_t& stats = *_tl_arena_statistics;
+            _publish_add(stats.oversized, 1);
+            _publish_max(stats.largest_request, n);
+            _publish_add(stats.bytes_bumped, n);
+            stats.frame_bytes += n;
+            _publish_add(stats.reserved_bytes, _arena_size(q));
+            return _arena_align(q->data, alignment);
+        }
+        _arena_t* q = _arena_slab_acquire(m);
+        unsigned char* r = _arena_align(q->data, alignment);
+        q->begin = r + n;
         q->predecessor = p;
         _tl_arena = q;
-        return q->data;
+        _arena_statistics_t& stats = *_tl_arena_statistics;
+        _publish_add(stats.growths, 1);
+        _publish_max(stats.largest_request, n);
+        _publish_bumped(stats, p);
+        _publish_add(stats.wasted_tail_bytes, p->end - p->begin);
+        _publish_add(stats.reserved_bytes, _arena_size(q));
+        return r;
     }
     
-    void arena_initialize() {
+    void arena_initialize(arena_options options) {
+        assert(options.numa_node < ARENA_NUMA_NODES);
+        _tl_arena_options = options;
+        _tl_arena_pool = _arena_pool[(options.numa_node + 1) * 2 + options.huge_pages];
         // allocate 1 Mb
         size_t m = 1 << 20;
-        _arena_t* p = (_arena_t*)malloc(m);
+        _arena_t* p = _arena_slab_acquire(m);
         p->begin = p->data;
-        p->end = (unsigned char*)p + m;
         p->predecessor = nullptr;
         assert(_tl_arena == nullptr);
         _tl_arena = p;
+        assert(_tl_arena_statistics == nullptr);
+        _arena_statistics_t* stats = new _arena_statistics_t;
+        stats->reserved_bytes.store(_arena_size(p), Ordering::RELAXED);
+        _tl_arena_statistics = stats;
+        std::unique_lock lock{_arena_registry_mutex};
+        stats->next = std::exchange(_arena_registry_head, stats);
+        if (stats->next)
+            stats->next->prev = stats;
     }
     
-    void area_advance() {
+    void arena_advance() {
         _arena_t* p = _tl_arena;
+        _arena_statistics_t& stats = *_tl_arena_statistics;
+        _publish_bumped(stats, p);
+        stats.last_frame_bytes.store(stats.frame_bytes, Ordering::RELAXED);
+        _publish_max(stats.frame_high_water, stats.frame_bytes);
+        _publish_add(stats.frames, 1);
+        stats.reserved_bytes.store(_arena_size(p), Ordering::RELAXED);
+        stats.frame_bytes = 0;
         // reset the largest arena
         p->begin = p->data;
-        // free the other regions
-        p = p->predecessor;
+        // blocks on the free lists are now part of the free tail
+        _arena_free_lists_clear();
+        // retire the other regions to the pool
+        p = std::exchange(p->predecessor, nullptr);
         while (p) {
             _arena_t* q = p->predecessor;
+            _arena_pool_return(p);
+            p = q;
+        }
+    }
+    
+    size_t arena_reserved() {
+        size_t n = 0;
+        for (_arena_t* p = _tl_arena; p; p = p->predecessor)
+            n += p->end - (unsigned char*)p;
+        return n;
+    }
+    
+    void* _bump_allocator_grow(BumpAllocator*& allocator, size_t alignment, size_t size) {
+        // Room for the header, the request and its alignment, and at least
+        // double the previous slab
+        size_t m = BUMP_ALLOCATOR_INITIAL_SIZE;
+        if (allocator)
+            m = allocator->size << 1;
+        size_t need = sizeof(BumpAllocator) + size + alignment - 1;
+        while (m < need)
+            m <<= 1;
+        BumpAllocator* slab = (BumpAllocator*)malloc(m);
+        if (!slab)
+            abort();
+        slab->lower_bound = (intptr_t)(slab + 1);
+        slab->size = m;
+        slab->predecessor = allocator;
+        intptr_t aligned_address = ((intptr_t)slab + m - size) & ~(intptr_t)(alignment - 1);
+        assert(!(aligned_address < slab->lower_bound));
+        slab->address = aligned_address;
+        allocator = slab;
+        return (void*)aligned_address;
+    }
+    
+    void bump_allocator_reset(BumpAllocator*& allocator) {
+        BumpAllocator* slab = allocator;
+        if (!slab)
+            return;
+        slab->address = (intptr_t)slab + slab->size;
+        BumpAllocator* p = std::exchange(slab->predecessor, nullptr);
+        while (p) {
+            BumpAllocator* q = p->predecessor;
+            free(p);
+            p = q;
+        }
+    }
+    
+    void bump_allocator_release(BumpAllocator*& allocator) {
+        BumpAllocator* p = std::exchange(allocator, nullptr);
+        while (p) {
+            BumpAllocator* q = p->predecessor;
             free(p);
             p = q;
         }
@@ -48,15 +486,30 @@ namespace aaa {
     void arena_finalize() {
         _arena_t* p = _tl_arena;
         assert(p);
-        ptrdiff_t n = 0;
+        _arena_statistics_t* stats = std::exchange(_tl_arena_statistics, nullptr);
+        _publish_bumped(*stats, p);
+        _publish_max(stats->frame_high_water, stats->frame_bytes);
+        arena_statistics final = _snapshot(*stats);
+        // a finalized thread has no frame in progress, and holds nothing
+        final.last_frame_bytes = 0;
+        final.reserved_bytes = 0;
+        {
+            std::unique_lock lock{_arena_registry_mutex};
+            _accumulate(_arena_retired_statistics, final);
+            (stats->prev ? stats->prev->next : _arena_registry_head) = stats->next;
+            if (stats->next)
+                stats->next->prev = stats->prev;
+        }
+        delete stats;
         while (p) {
-            n += p->end - (unsigned char*)p;
             _arena_t* q = p->predecessor;
-            free(p);
+            _arena_pool_return(p);
             p = q;
         }
         _tl_arena = nullptr;
-        printf("thread allocated %g Mb\n", n / (1024.0 * 1024.0));
+        _arena_free_lists_clear();
+        _tl_arena_options = {};
+        _tl_arena_pool = _arena_pool[0];
     }
     
 }
@@ -12,6 +12,10 @@
 #include <cstdio>
 #include <cstdlib>
 #include <cstddef>
+#include <cstdint>
+
+#include <memory_resource>
+#include <vector>
 
 namespace aaa {
     
@@ -25,20 +29,26 @@ namespace aaa {
     // Objects so allocated will be not be destructed; they should be
     // TriviallyDestructible
     //
-    // We don't enforce alignment, which is equivalent to requiring that all
-    // objects allocated must have a size divisible by the alignment of the
-    // most-aligned object
+    // arena_allocate doesn't enforce alignment, which is equivalent to
+    // requiring that all objects allocated must have a size divisible by the
+    // alignment of the most-aligned object; arena_allocate_aligned rounds
+    // the bump pointer up instead.  Requests too large for the slab get a
+    // slab of their own.
+    //
+    // Within a frame, short-lived blocks like coroutine frames can be
+    // handed back with arena_recycle and reused by the next
+    // arena_allocate_recyclable of the same size class on the same thread
     
     struct _arena_t {
         unsigned char* begin;  // next allocation
         unsigned char* end;    // first unavailable byte
-        _arena_t* predecessor; // previous allocation
-        void* _padding;        // put data[] at a 16 byte offset
+        _arena_t* predecessor; // previous allocation, or next in the pool
+        uint64_t pooled;       // frame it was pooled, and if since advised
         unsigned char data[0]; // the bytes following
     };
     
     inline thread_local _arena_t* _tl_arena = nullptr;
-    void* _arena_allocate_cold(size_t n);
+    void* _arena_allocate_cold(size_t n, size_t alignment);
     
 
     // this is the critical hot function
@@ -52,47 +62,219 @@ namespace aaa {
             // printf("%p\n", q);
             return q;
         } else [[unlikely]] {
-            return _arena_allocate_cold(n);
+            return _arena_allocate_cold(n, 1);
+        }
+    }
+    
+    // alignment must be a power of two
+    inline void* arena_allocate_aligned(size_t n, size_t alignment) {
+        _arena_t* p = _tl_arena;
+        intptr_t q = ((intptr_t)p->begin + (intptr_t)(alignment - 1)) & -(intptr_t)alignment;
+        if (((intptr_t)p->end - q) >= (intptr_t)n) [[likely]] {
+            p->begin = (unsigned char*)q + n;
+            return (void*)q;
+        } else [[unlikely]] {
+            return _arena_allocate_cold(n, alignment);
+        }
+    }
+    
+    // Size classes of 16 byte granules, up to 1 KiB, aligned to a granule
+    
+    constexpr size_t ARENA_GRANULE = 16;
+    constexpr size_t ARENA_SIZE_CLASSES = 64;
+    
+    struct _arena_free_t {
+        _arena_free_t* next;
+    };
+    
+    inline thread_local _arena_free_t* _tl_arena_free[ARENA_SIZE_CLASSES] = {};
+    
+    constexpr size_t _arena_size_class(size_t n) {
+        return n ? (n - 1) / ARENA_GRANULE : 0;
+    }
+    
+    inline void* arena_allocate_recyclable(size_t n) {
+        size_t k = _arena_size_class(n);
+        if (k < ARENA_SIZE_CLASSES) [[likely]] {
+            if (_arena_free_t* q = _tl_arena_free[k]) {
+                _tl_arena_free[k] = q->next;
+                return q;
+            }
+            n = (k + 1) * ARENA_GRANULE;
+        }
+        return arena_allocate_aligned(n, ARENA_GRANULE);
+    }
+    
+    // Return a block from arena_allocate_recyclable, of the size it was
+    // requested with.  Only blocks from the calling thread's current slab
+    // are kept; a block from another thread's arena, or from a slab that
+    // arena_advance may free, is abandoned until the arena is rewound
+    inline void arena_recycle(void* q, size_t n) {
+        size_t k = _arena_size_class(n);
+        _arena_t* p = _tl_arena;
+        if ((k < ARENA_SIZE_CLASSES)
+            && ((uintptr_t)p->data <= (uintptr_t)q)
+            && ((uintptr_t)q < (uintptr_t)p->begin)) {
+            _arena_free_t* r = (_arena_free_t*)q;
+            r->next = _tl_arena_free[k];
+            _tl_arena_free[k] = r;
         }
     }
     
-    void arena_initialize();
+    // How a thread's arena slabs are backed.  Both options map slabs
+    // directly, where supported, and fall back to malloc where not
+    
+    constexpr int ARENA_NUMA_NODES = 16;
+    
+    struct arena_options {
+        // MAP_HUGETLB where the system has huge pages reserved, and
+        // otherwise huge-page-aligned mappings hinted MADV_HUGEPAGE
+        bool huge_pages = false;
+        // prefer this node for the pages, or -1 to leave placement to first
+        // touch; less than ARENA_NUMA_NODES
+        int numa_node = -1;
+    };
+    
+    void arena_initialize(arena_options options = {});
     void arena_finalize();
+    // Rewind the calling thread's arena, keeping only its largest slab;
+    // everything allocated since the last advance must be dead
     void arena_advance();
+    // Bytes of slab held by the calling thread's arena
+    size_t arena_reserved();
+    
+    // Slabs outgrown by an arena are retired to a global pool at the next
+    // advance, and drawn back by any thread's arena before it resorts to
+    // malloc.  Each tick counts a frame, and lets the kernel reclaim the
+    // pages of slabs that have gone unused for decay_frames
+    
+    constexpr uint64_t ARENA_POOL_DECAY_FRAMES = 60;
+    
+    void arena_pool_tick(uint64_t decay_frames = ARENA_POOL_DECAY_FRAMES);
+    
+    struct arena_pool_statistics {
+        uint64_t hits;         // slabs drawn from the pool
+        uint64_t misses;       // slabs that had to be malloced
+        uint64_t advised;      // slabs whose pages were offered back
+        uint64_t pooled_bytes; // held by the pool now
+    };
+    
+    arena_pool_statistics arena_pool_stats();
+    
+    // Counters for sizing the initial slab to a workload.  Each thread
+    // publishes its own when it grows, advances or finalizes, so a snapshot
+    // lags the bytes bumped into the current slab, but may be taken at any
+    // time from any thread without stopping the workers
+    
+    struct arena_statistics {
+        uint64_t bytes_bumped;      // including alignment padding
+        uint64_t growths;           // slabs added by doubling
+        uint64_t oversized;         // dedicated slabs for big requests
+        uint64_t largest_request;   // of those that missed the fast path
+        uint64_t last_frame_bytes;  // bumped between the last two advances
+        uint64_t frame_high_water;  // most bumped between two advances
+        uint64_t wasted_tail_bytes; // left unused in slabs outgrown
+        uint64_t frames;            // advances
+        uint64_t reserved_bytes;    // slab held now
+    };
+    
+    // The calling thread's counters
+    arena_statistics arena_stats();
+    // Each live thread's counters
+    std::vector<arena_statistics> arena_stats_per_thread();
+    // Summed over every thread, live or finalized, except the largest
+    // request and frame high water, which are maxima
+    arena_statistics arena_stats_total();
         
     
     
+    // Downward-bumping allocator
+    //
+    // Each slab starts with this header; allocations are carved from the top
+    // of the slab downwards, so that aligning the result is a single mask.
+    // A BumpAllocator* names the newest slab in a chain, or is null before
+    // the first allocation.  Like the arena, nothing is freed individually;
+    // the whole chain is reset at once when its contents are dead.
+    
     // TODO: Put all metadata in a struct that lives in the thread_local
     // service object that is cache hot, and then when the slab is exhausted
     // copy this metadata as the first allocation of the new slab?
     
     struct BumpAllocator {
-        intptr_t address;
-        intptr_t lower_bound;
-        size_t size;
-        BumpAllocator* predecessor;
+        intptr_t address;            // lowest allocated byte
+        intptr_t lower_bound;        // first byte after this header
+        size_t size;                 // of the slab, including this header
+        BumpAllocator* predecessor;  // older, smaller slab
     };
     
+    constexpr size_t BUMP_ALLOCATOR_INITIAL_SIZE = 1 << 16;
+    
     inline thread_local BumpAllocator* thread_local_bump_allocator = nullptr;
     
-    void* _bump_allocator_grow(BumpAllocator* allocator, size_t alignment, size_t size);
+    void* _bump_allocator_grow(BumpAllocator*& allocator, size_t alignment, size_t size);
     
-    inline void* bump_allocator_aligned_alloc(std::size_t alignment, std::size_t size) {
-        BumpAllocator* allocator = thread_local_bump_allocator;
-        intptr_t address = allocator->address;
-        intptr_t lower_bound = allocator->lower_bound;
-        intptr_t new_address = address - size;
-        intptr_t aligned_address = new_address & (alignment - 1);
-        bool success = !(aligned_address < lower_bound);
-        if (success) [[likely]] {
-            allocator->address = aligned_address;
-            return (void*)aligned_address;
-        } else [[unlikely]] {
-            return _bump_allocator_grow(allocator, alignment, size);
+    // alignment must be a power of two
+    inline void* bump_allocator_aligned_alloc(BumpAllocator*& allocator, std::size_t alignment, std::size_t size) {
+        if (BumpAllocator* slab = allocator) [[likely]] {
+            intptr_t address = slab->address;
+            intptr_t lower_bound = slab->lower_bound;
+            intptr_t new_address = address - size;
+            intptr_t aligned_address = new_address & ~(intptr_t)(alignment - 1);
+            bool success = !(aligned_address < lower_bound);
+            if (success) [[likely]] {
+                slab->address = aligned_address;
+                return (void*)aligned_address;
+            }
         }
+        return _bump_allocator_grow(allocator, alignment, size);
     }
     
+    inline void* bump_allocator_aligned_alloc(std::size_t alignment, std::size_t size) {
+        return bump_allocator_aligned_alloc(thread_local_bump_allocator, alignment, size);
+    }
+    
+    // Make everything allocated available again, keeping only the newest
+    // (and largest) slab
+    void bump_allocator_reset(BumpAllocator*& allocator);
+    
+    // Free every slab
+    void bump_allocator_release(BumpAllocator*& allocator);
+    
+    // Adapts a private slab chain for std::pmr containers.  Deallocation is
+    // a no-op; a container that reallocates abandons its old buffer until
+    // reset, so the resource holds at most about twice the peak
     
+    struct bump_memory_resource : std::pmr::memory_resource {
+        
+        BumpAllocator* _allocator = nullptr;
+        
+        bump_memory_resource() = default;
+        bump_memory_resource(const bump_memory_resource&) = delete;
+        
+        ~bump_memory_resource() override {
+            bump_allocator_release(_allocator);
+        }
+        
+        bump_memory_resource& operator=(const bump_memory_resource&) = delete;
+        
+        // Every allocation from this resource must be dead
+        void reset() {
+            bump_allocator_reset(_allocator);
+        }
+        
+        void* do_allocate(std::size_t bytes, std::size_t alignment) override {
+            return bump_allocator_aligned_alloc(_allocator, alignment, bytes);
+        }
+        
+        void do_deallocate(void*, std::size_t, std::size_t) override {
+            // no-op
+        }
+        
+        bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+            return this == &other;
+        }
+        
+    }; // struct bump_memory_resource
     
 } // namespace aaa
 
@@ -5,4 +5,29 @@
 //  Created by Antony Searle on 21/1/2025.
 //
 
+#include <bit>
+
 #include "atomic.hpp"
+
+namespace aaa {
+    
+#if defined(__linux__)
+    
+    namespace _atomic_wait {
+        
+        constexpr size_t BUCKET_COUNT = 256;
+        
+        bucket_t _buckets[BUCKET_COUNT];
+        
+        bucket_t& bucket_for(const void* address) {
+            // Fibonacci hashing; discard the low bits, which are mostly
+            // alignment
+            uint64_t h = ((uint64_t)address >> 3) * (uint64_t)0x9E3779B97F4A7C15;
+            return _buckets[h >> (64 - std::countr_zero(BUCKET_COUNT))];
+        }
+        
+    } // namespace _atomic_wait
+    
+#endif // defined(__linux__)
+    
+} // namespace aaa
@@ -28,13 +28,17 @@
 // WakeByAddressAll
 #endif
 
-#if defined(LINUX)
+#if defined(__linux__)
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
 #include <linux/futex.h>      /* Definition of FUTEX_* constants */
 #include <sys/syscall.h>      /* Definition of SYS_* constants */
 #include <unistd.h>
 #endif
 
 #include <atomic>
+#include <cstdint>
 
 namespace aaa {
     
@@ -64,6 +68,89 @@ namespace aaa {
         TIMEOUT,
     };
     
+    // The clock used for Atomic::wait_until deadlines, in its native units
+    //
+    // appleOS: mach_absolute_time ticks
+    // Linux: CLOCK_MONOTONIC nanoseconds
+    inline uint64_t atomic_wait_clock_now() {
+#if defined(__APPLE__)
+        return mach_absolute_time();
+#elif defined(__linux__)
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+#else
+        return 0;
+#endif
+    }
+    
+#if defined(__linux__)
+    
+    namespace _atomic_wait {
+        
+        // Linux futexes only operate on 32-bit words.  Atomics of other sizes,
+        // notably 64-bit ones like Atomic<TaggedPtr> and Atomic<ptrdiff_t>,
+        // instead park on the futex of a bucket in a global table hashed by
+        // address.  The bucket's generation is advanced by every notify of any
+        // address that hashes to it, so waiters must tolerate spurious
+        // wakeups (which callers of wait already must).  The waiter count
+        // lets notify skip the syscall when nobody is parked.
+        
+        struct alignas(CACHE_LINE_SIZE) bucket_t {
+            std::atomic<uint32_t> generation;
+            std::atomic<uint32_t> waiters;
+        };
+        
+        bucket_t& bucket_for(const void* address);
+        
+        // returns zero or an errno; deadline is absolute CLOCK_MONOTONIC, or
+        // nullptr to wait indefinitely
+        inline int futex_wait(const void* address,
+                              uint32_t expected,
+                              const struct timespec* deadline) {
+            long result = (deadline
+                           ? syscall(SYS_futex,
+                                     address,
+                                     FUTEX_WAIT_BITSET_PRIVATE,
+                                     expected,
+                                     deadline,
+                                     nullptr,
+                                     FUTEX_BITSET_MATCH_ANY)
+                           : syscall(SYS_futex,
+                                     address,
+                                     FUTEX_WAIT_PRIVATE,
+                                     expected,
+                                     nullptr,
+                                     nullptr,
+                                     0));
+            return result == -1 ? errno : 0;
+        }
+        
+        inline void futex_wake(const void* address, int count) {
+            long result = syscall(SYS_futex,
+                                  address,
+                                  FUTEX_WAKE_PRIVATE,
+                                  count,
+                                  nullptr,
+                                  nullptr,
+                                  0);
+            if (result == -1) {
+                perror(__PRETTY_FUNCTION__);
+                abort();
+            }
+        }
+        
+        inline void bucket_notify_all(const void* address) {
+            bucket_t& bucket = bucket_for(address);
+            bucket.generation.fetch_add(1, std::memory_order_seq_cst);
+            if (bucket.waiters.load(std::memory_order_seq_cst))
+                futex_wake(&bucket.generation, INT_MAX);
+        }
+        
+    } // namespace _atomic_wait
+    
+#endif // defined(__linux__)
+    
     template<typename T>
     struct Atomic {
         
@@ -128,8 +215,10 @@ return __atomic_##Y##_fetch (&value, operand, (int)order);\
         
         X(add)
         X(and)
+#if defined(__clang__)
         X(max)
         X(min)
+#endif
         X(nand)
         X(or)
         X(sub)
@@ -137,6 +226,31 @@ return __atomic_##Y##_fetch (&value, operand, (int)order);\
         
 #undef X
         
+#if !defined(__clang__)
+        
+        // gcc lacks __atomic_fetch_max and friends
+        
+#define X(Y, Z) \
+\
+T fetch_##Y (T operand, Ordering order) {\
+T expected = load(Ordering::RELAXED);\
+while (!(operand Z expected) && !compare_exchange_weak(expected, operand, order, Ordering::RELAXED))\
+;\
+return expected;\
+}\
+\
+T Y##_fetch(T operand, Ordering order) {\
+T discovered = fetch_##Y(operand, order);\
+return (operand Z discovered) ? discovered : operand;\
+}
+        
+        X(max, <=)
+        X(min, >=)
+        
+#undef X
+        
+#endif // !defined(__clang__)
+        
 #if defined(__APPLE__)
         
         void wait(T& expected, Ordering order) {
@@ -228,6 +342,88 @@ return __atomic_##Y##_fetch (&value, operand, (int)order);\
         
 #endif // defined(__APPLE__)
         
+#if defined(__linux__)
+        
+        AtomicWaitResult _wait_until(T& expected,
+                                     Ordering order,
+                                     const struct timespec* deadline) {
+            static_assert(sizeof(T) <= 8);
+            for (;;) {
+                _atomic_wait::bucket_t* bucket = nullptr;
+                uint32_t generation = 0;
+                if constexpr (sizeof(T) != 4) {
+                    // Announce ourself before reading the generation, so that
+                    // a notifier either sees us or we see its increment
+                    bucket = &_atomic_wait::bucket_for(&value);
+                    bucket->waiters.fetch_add(1, std::memory_order_seq_cst);
+                    generation = bucket->generation.load(std::memory_order_seq_cst);
+                }
+                T discovered = load(order);
+                if (__builtin_memcmp(&expected, &discovered, sizeof(T))) {
+                    if (bucket)
+                        bucket->waiters.fetch_sub(1, std::memory_order_relaxed);
+                    expected = discovered;
+                    return AtomicWaitResult::NO_TIMEOUT;
+                }
+                int error;
+                if constexpr (sizeof(T) == 4) {
+                    uint32_t buffer;
+                    __builtin_memcpy(&buffer, &expected, sizeof(T));
+                    error = _atomic_wait::futex_wait(&value, buffer, deadline);
+                } else {
+                    error = _atomic_wait::futex_wait(&bucket->generation, generation, deadline);
+                    bucket->waiters.fetch_sub(1, std::memory_order_relaxed);
+                }
+                switch (error) {
+                    case 0:
+                    case EAGAIN:
+                    case EINTR:
+                        break;
+                    case ETIMEDOUT:
+                        return AtomicWaitResult::TIMEOUT;
+                    default:
+                        errno = error;
+                        perror(__PRETTY_FUNCTION__);
+                        abort();
+                }
+            }
+        }
+        
+        void wait(T& expected, Ordering order) {
+            (void) _wait_until(expected, order, nullptr);
+        }
+        
+        AtomicWaitResult wait_until(T& expected, Ordering order, uint64_t deadline) {
+            struct timespec ts;
+            ts.tv_sec = (time_t)(deadline / 1000000000);
+            ts.tv_nsec = (long)(deadline % 1000000000);
+            return _wait_until(expected, order, &ts);
+        }
+        
+        AtomicWaitResult wait_for(T& expected, Ordering order, uint64_t timeout_ns) {
+            return wait_until(expected, order, atomic_wait_clock_now() + timeout_ns);
+        }
+        
+        void notify_one() {
+            if constexpr (sizeof(T) == 4) {
+                _atomic_wait::futex_wake(&value, 1);
+            } else {
+                // Parked threads may be waiting on other addresses that share
+                // the bucket, so waking only one could strand our waiter
+                _atomic_wait::bucket_notify_all(&value);
+            }
+        }
+        
+        void notify_all() {
+            if constexpr (sizeof(T) == 4) {
+                _atomic_wait::futex_wake(&value, INT_MAX);
+            } else {
+                _atomic_wait::bucket_notify_all(&value);
+            }
+        }
+        
+#endif // defined(__linux__)
+        
     }; // template<typename> struct Atomic
     
 } // namespace aaa
@@ -16,20 +16,44 @@
 #include <exception>
 
 #include <mutex>
+#include <utility>
 
+#include "atomic.hpp"
 #include "concurrent_deque.hpp"
 #include "work_stealing_deque.hpp"
 
 namespace aaa {
     
-    inline work_stealing_deque<std::coroutine_handle<>>* work_queues[10] = {};
+    // Enough inline slots for a frame's typical fan-out; bursts spill
+    using _scheduler_queue_t = bounded_work_stealing_deque<std::coroutine_handle<>, 256>;
+    
+    // The scheduler state of this thread, bound by the thread_pool that
+    // started it (or by the thread_pool constructor, for the owning thread)
+    struct _scheduler_binding_t {
+        _scheduler_queue_t* queue = nullptr;
+        // Threads about to sleep publish the generation they will sleep on
+        // to every queue; if it has caught up with the generation we last
+        // advanced to, somebody may be sleeping through our new work
+        Atomic<ptrdiff_t>* sleep_generation_local = nullptr;
+        ptrdiff_t sleep_generation_cached = 0;
+        Atomic<ptrdiff_t>* sleep_generation_global = nullptr;
+    };
+    
+    inline thread_local _scheduler_binding_t _tl_scheduler;
     
-    inline thread_local int tlq_index = 0;
+    // Advance the global sleep generation and wake its sleepers
+    void _scheduler_wake(_scheduler_binding_t& binding, ptrdiff_t observed);
     
     inline void schedule_coroutine_handle(std::coroutine_handle<> handle) {
-        // work_queue.emplace(handle);
-        // work_queues[tlq_index].emplace(handle);
-        work_queues[tlq_index]->push(handle);
+        _scheduler_binding_t& binding = _tl_scheduler;
+        assert(binding.queue);
+        binding.queue->push(handle);
+        // Pairs with the fence in thread_pool's sleep path: either the
+        // sleeper sees our new work, or we see the generation it published
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        ptrdiff_t observed = binding.sleep_generation_local->load(Ordering::RELAXED);
+        if (observed >= binding.sleep_generation_cached) [[unlikely]]
+            _scheduler_wake(binding, observed);
     }
         
     inline void schedule_coroutine_handle_from_address(void* address) {
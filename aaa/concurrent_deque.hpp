@@ -8,18 +8,24 @@
 #ifndef concurrent_deque_hpp
 #define concurrent_deque_hpp
 
+#if defined(__APPLE__)
 #include <os/lock.h>
 #include <os/os_sync_wait_on_address.h>
+#endif // defined(__APPLE__)
 
 #include <condition_variable>
 #include <deque>
+#include <memory>
 #include <mutex>
 
 namespace aaa {
 
     // A straightforward concurrent queue built with STL
+    //
+    // Queues that live for a single frame can opt into a bump allocator with
+    // std::pmr::polymorphic_allocator<T> and a bump_memory_resource
     
-    template<typename T>
+    template<typename T, typename Allocator = std::allocator<T>>
     struct concurrent_deque_stl {
         
         // TODO: bad interface.  Enum?
@@ -31,12 +37,13 @@ namespace aaa {
         
         std::mutex _mutex;
         std::condition_variable _condition_variable;
-        std::deque<T> _queue;
+        std::deque<T, Allocator> _queue;
         ptrdiff_t _waiting;
         bool _done;
         
-        concurrent_deque_stl()
-        : _waiting(0)
+        explicit concurrent_deque_stl(const Allocator& allocator = Allocator())
+        : _queue(allocator)
+        , _waiting(0)
         , _done(false) {
         }
                 
@@ -99,6 +106,8 @@ namespace aaa {
     }; // concurrent_deque_stl
     
     
+#if defined(__APPLE__)
+    
     // A better-performing concurrent queue built with Apple-specific
     // os_unfair_lock and os_sync_wait_on_address
     
@@ -250,6 +259,8 @@ namespace aaa {
         
     }; // concurrent_deque_apple
     
+#endif // defined(__APPLE__)
+    
     
     
 
@@ -0,0 +1,8 @@
+//
+//  execution_policy.cpp
+//  aaa
+//
+//  Created by Antony Searle on 23/1/2025.
+//
+
+#include "execution_policy.hpp"
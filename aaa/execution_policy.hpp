@@ -0,0 +1,42 @@
+//
+//  execution_policy.hpp
+//  aaa
+//
+//  Created by Antony Searle on 23/1/2025.
+//
+
+#ifndef execution_policy_hpp
+#define execution_policy_hpp
+
+namespace aaa {
+    
+    // How the recursive trie algorithms run their subproblems
+    //
+    // Spawning a subproblem costs a coroutine frame, a queue push, perhaps
+    // a steal, and a resume of the parent.  That is worth paying to expose
+    // parallelism, but not for a parent that spawns a single child and
+    // immediately waits for it, nor for subtrees so small that the serial
+    // algorithm finishes before a thief could arrive.
+    
+    struct execution_policy {
+        
+        // Descend into a lone subproblem in the parent's own frame rather
+        // than spawning it and waiting
+        bool inline_single = true;
+        
+        // Process subtrees whose nodes are at or below this shift with the
+        // serial algorithm; -1 spawns all the way down to the leaves.  The
+        // default hands each task at most 64 leaves, or 4096 keys, which
+        // halves the cost of building a dense trie on a single thread
+        int serial_shift = 6;
+        
+        // Spawn every subproblem
+        static constexpr execution_policy spawn() {
+            return execution_policy{.inline_single = false, .serial_shift = -1};
+        }
+        
+    }; // struct execution_policy
+    
+} // namespace aaa
+
+#endif /* execution_policy_hpp */
@@ -8,7 +8,16 @@
 #ifndef fork_hpp
 #define fork_hpp
 
+#include <cassert>
+
+#include <coroutine>
+#include <exception>
+#include <utility>
+
+#include "allocator.hpp"
+#include "atomic.hpp"
 #include "awaitable.hpp"
+#include "latch.hpp"
 
 namespace aaa {
     
@@ -25,33 +34,228 @@ namespace aaa {
     // same goodness; each thread runs its youngest job but steals other
     // thread's oldest job
     
-    struct co_fork {
+    // Continuation-stealing fork/join
+    //
+    //     fork_task fib(int n, int* result) {
+    //         if (n < 2) { *result = n; co_return; }
+    //         int a, b;
+    //         co_await co_fork{fib(n - 1, &a)};
+    //         co_await co_fork{fib(n - 2, &b)};
+    //         co_await co_join{};
+    //         *result = a + b;
+    //     }
+    //
+    // co_fork pushes the parent's continuation onto this thread's queue and
+    // runs the child immediately, like a function call.  When the child
+    // completes it pops the continuation back and resumes it inline, unless
+    // a thief stole it in the meantime, in which case the child instead
+    // counts itself off against the parent's join.  co_join resumes inline
+    // when nothing was stolen since the last join, and otherwise suspends
+    // until the last stolen-from child completes.
+    //
+    // A fork_task must co_join before it returns.  Results are written
+    // through arguments, as with latch::signalling_coroutine.  A fork_task
+    // may also be co_awaited directly, from any coroutine, to run it to
+    // completion as a root.
+    
+    struct fork_task {
+        
+        // stolen children subtract one each, and the join subtracts the rest
+        constexpr static int JOIN_BIAS = 1 << 30;
         
-        std::coroutine_handle<> _handle;
+        struct promise_type;
+        
+        std::coroutine_handle<promise_type> _handle;
+        
+        explicit fork_task(std::coroutine_handle<promise_type> handle)
+        : _handle(handle) {
+        }
+        
+        fork_task(fork_task&& other)
+        : _handle(std::exchange(other._handle, nullptr)) {
+        }
+        
+        ~fork_task() {
+            // a fork_task must be forked or awaited
+            assert(_handle == nullptr);
+        }
+        
+        fork_task& operator=(fork_task&&) = delete;
+        
+        // run as a root, resuming the awaiter when complete
         
         constexpr bool await_ready() const noexcept {
             return false;
         }
         
-        std::coroutine_handle<> await_suspend(std::coroutine_handle<> outer) noexcept {
-            schedule_coroutine_handle(outer);
-            return std::exchange(_handle, nullptr);
-        }
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> outer) noexcept;
         
         void await_resume() const noexcept {
         }
         
-        ~co_fork() {
-            assert(_handle == nullptr);
+    }; // struct fork_task
+    
+    struct co_fork {
+        
+        fork_task _child;
+        fork_task::promise_type* _parent = nullptr;
+        
+        // not an aggregate; GCC 12 miscompiles aggregate temporaries in
+        // co_await expressions
+        explicit co_fork(fork_task&& child)
+        : _child(std::move(child)) {
         }
         
-    };
+        co_fork(co_fork&&) = default;
+        
+        constexpr bool await_ready() const noexcept {
+            return false;
+        }
+        
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> outer) noexcept;
+        
+        constexpr void await_resume() const noexcept {
+        }
+        
+    }; // struct co_fork
     
     struct co_join {
         
-    };
+        fork_task::promise_type* _promise = nullptr;
+        
+        bool await_ready() const noexcept;
+        bool await_suspend(std::coroutine_handle<>) noexcept;
+        void await_resume() noexcept;
+        
+    }; // struct co_join
+    
+    struct fork_task::promise_type {
+        
+        static void* operator new(std::size_t count) {
+            return arena_allocate_recyclable(count);
+        }
+        
+        static void operator delete(void* ptr, std::size_t count) {
+            arena_recycle(ptr, count);
+        }
+        
+        // the forking parent, or null for a root
+        promise_type* _parent = nullptr;
+        // resumed when a root completes
+        std::coroutine_handle<> _continuation = nullptr;
+        
+        // children forked since the last join that did not pop this task's
+        // continuation back, i.e. whose continuation was stolen; only
+        // touched by whoever holds the continuation
+        int _steals = 0;
+        Atomic<int> _joins{JOIN_BIAS};
+        
+        fork_task get_return_object() noexcept {
+            return fork_task{std::coroutine_handle<promise_type>::from_promise(*this)};
+        }
+        
+        constexpr std::suspend_always initial_suspend() const noexcept {
+            return {};
+        }
+        
+        auto final_suspend() const noexcept {
+            struct awaitable {
+                constexpr bool await_ready() const noexcept {
+                    return false;
+                }
+                std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> handle) const noexcept {
+                    promise_type& promise = handle.promise();
+                    assert(promise._steals == 0); // forgot to co_join?
+                    promise_type* parent = promise._parent;
+                    std::coroutine_handle<> continuation = promise._continuation;
+                    handle.destroy();
+                    if (!parent)
+                        return continuation;
+                    auto parent_handle = std::coroutine_handle<promise_type>::from_promise(*parent);
+                    std::coroutine_handle<> popped = nullptr;
+                    if (_tl_scheduler.queue->pop(popped)) {
+                        if (popped == parent_handle) {
+                            // nobody stole the continuation
+                            --parent->_steals;
+                            return popped;
+                        }
+                        // A batched steal can leave an ancestor above the
+                        // items it brought along; put it back
+                        schedule_coroutine_handle(popped);
+                    }
+                    // the continuation was stolen, or is out of our reach;
+                    // the last child to finish resumes a parent waiting at
+                    // its join
+                    if (parent->_joins.sub_fetch(1, Ordering::ACQ_REL) == 0)
+                        return parent_handle;
+                    return std::noop_coroutine();
+                }
+                void await_resume() const noexcept {
+                }
+            };
+            return awaitable{};
+        }
+        
+        constexpr void return_void() const noexcept { }
+        void unhandled_exception() const noexcept { std::terminate(); }
+        
+        co_fork await_transform(co_fork&& x) noexcept {
+            x._parent = this;
+            x._child._handle.promise()._parent = this;
+            return std::move(x);
+        }
+        
+        co_join await_transform(co_join x) noexcept {
+            x._promise = this;
+            return x;
+        }
+        
+        template<typename A>
+        A&& await_transform(A&& x) noexcept {
+            return std::forward<A>(x);
+        }
+        
+    }; // struct fork_task::promise_type
+    
+    inline std::coroutine_handle<> fork_task::await_suspend(std::coroutine_handle<> outer) noexcept {
+        _handle.promise()._continuation = outer;
+        return std::exchange(_handle, nullptr);
+    }
+    
+    inline std::coroutine_handle<> co_fork::await_suspend(std::coroutine_handle<> outer) noexcept {
+        // Count the child as stolen from until it pops us back.  We can't
+        // tell a steal by which thread resumes us, since a batched steal can
+        // hand us back to the thread that pushed us.
+        ++_parent->_steals;
+        // once outer is published a thief may resume it and destroy this
+        // awaiter, so we must be done with our members first
+        std::coroutine_handle<> child = std::exchange(_child._handle, nullptr);
+        schedule_coroutine_handle(outer);
+        return child;
+    }
+    
+    inline bool co_join::await_ready() const noexcept {
+        return _promise->_steals == 0;
+    }
+    
+    inline bool co_join::await_suspend(std::coroutine_handle<>) noexcept {
+        int remainder = fork_task::JOIN_BIAS - _promise->_steals;
+        // if the stolen children have all completed, don't suspend
+        return _promise->_joins.sub_fetch(remainder, Ordering::ACQ_REL) != 0;
+    }
+    
+    inline void co_join::await_resume() noexcept {
+        if (_promise->_steals) {
+            _promise->_steals = 0;
+            _promise->_joins.store(fork_task::JOIN_BIAS, Ordering::RELAXED);
+        }
+    }
     
+    // Run a fork_task tree as one child of a latch
+    inline latch::signalling_coroutine fork_root(latch& outer, fork_task task) {
+        co_await std::move(task);
+    }
     
-}
+} // namespace aaa
 
 #endif /* fork_hpp */
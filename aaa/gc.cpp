@@ -6,12 +6,22 @@
 //
 
 #include <cinttypes>
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <mutex>
 #include <thread>
+#include <vector>
 
+#include "allocator.hpp"
 #include "atomic.hpp"
 #include "gc.hpp"
+#include "heap.hpp"
 #include "object.hpp"
 #include "tagged_ptr.hpp"
+#include "termination_detection_barrier.hpp"
+#include "work_stealing_deque.hpp"
 // #include "utility.hpp"
 
 namespace aaa::gc {
@@ -23,20 +33,17 @@ namespace aaa::gc {
     // True O(1) splice to combine logs
     
     template<typename T>
-    struct Bag;
-    
-    template<typename T>
-    struct Bag<T*> {
+    struct Bag {
         
         struct Page {
             
-            constexpr static size_t CAPACITY = (4096 - 16) / sizeof(T*);
+            constexpr static size_t CAPACITY = (4096 - 16) / sizeof(T);
             
             Page* next;
             size_t count;
-            T* elements[CAPACITY];
+            T elements[CAPACITY];
             
-            Page(Page* next, T* item) {
+            Page(Page* next, T item) {
                 this->next = next;
                 count = 1;
                 elements[0] = item;
@@ -46,12 +53,12 @@ namespace aaa::gc {
             bool empty() const { return !count; }
             bool full() const { return count == CAPACITY; }
             
-            T*const& top() const {
+            const T& top() const {
                 assert(!empty());
                 return elements[count - 1];
             }
             
-            T*& top() {
+            T& top() {
                 assert(!empty());
                 return elements[count - 1];
             }
@@ -61,7 +68,7 @@ namespace aaa::gc {
                 --count;
             }
             
-            void push(T* x) {
+            void push(T x) {
                 assert(!full());
                 elements[count++] = std::move(x);
             }
@@ -70,10 +77,10 @@ namespace aaa::gc {
         
         static_assert(sizeof(Page) == 4096);
         
-        using value_type = T*;
+        using value_type = T;
         using size_type = std::size_t;
-        using reference = T*&;
-        using const_reference = T*const&;
+        using reference = T&;
+        using const_reference = const T&;
         
         Page* head;
         Page* tail;
@@ -115,7 +122,7 @@ namespace aaa::gc {
             return *this;
         }
         
-        T* const& top() const {
+        const T& top() const {
             assert(count);
             Page* page = head;
             for (;;) {
@@ -126,7 +133,7 @@ namespace aaa::gc {
             }
         }
         
-        T*& top() {
+        T& top() {
             assert(count);
             for (;;) {
                 assert(head);
@@ -144,7 +151,7 @@ namespace aaa::gc {
             return count;
         }
         
-        void push(T* x) {
+        void push(T x) {
             ++count;
             assert(!head == !tail);
             if (!head || head->full()) {
@@ -168,6 +175,13 @@ namespace aaa::gc {
             }
         }
         
+        // Hand over the list of pages, leaving the bag empty
+        Page* release() {
+            tail = nullptr;
+            count = 0;
+            return std::exchange(head, nullptr);
+        }
+        
         void splice(Bag&& other) {
             if (other.head) {
                 if (head) {
@@ -182,19 +196,93 @@ namespace aaa::gc {
             }
         }
         
-    }; // struct Bag<T*>
+    }; // struct Bag
     
     template<typename T>
-    void swap(Bag<T*>& left, Bag<T*>& right) {
+    void swap(Bag<T>& left, Bag<T>& right) {
         left.swap(right);
     }
     
+    // Parallel marking and sweeping
+    //
+    // Each marker claims pages of the object bag in turn and sorts their
+    // objects into its own WHITE and BLACK bags.  The objects it turns BLACK
+    // go onto its work-stealing deque until it scans them, and scanning
+    // pushes the children it turns BLACK in turn.  A marker that runs dry
+    // steals batches from the others, and the markers agree that the round
+    // is over once none has anything left, as told by a
+    // termination_detection_barrier.
+    //
+    // The sweep divides the object bag between the markers the same way.
+    // Each deletes the WHITE objects on the pages it claims, or in lazy
+    // mode sets them aside for the mutators, and sorts the rest into its
+    // own BLACK and RED bags.
+    //
+    // The collector thread is marker 0; the others are helper threads that
+    // park between rounds.
+    
+    struct Marker {
+        
+        // The gray stack only grows, and keeps its capacity from cycle to
+        // cycle, so the arrays it outgrows are all it ever abandons
+        bump_memory_resource gray_resource;
+        work_stealing_deque<const Object*> gray{&gray_resource};
+        Bag<const Object*> white_bag;
+        Bag<const Object*> black_bag;
+        Bag<const Object*> red_bag;
+        size_t scanned = 0;
+        std::intptr_t bytes_freed = 0;
+        
+    }; // struct Marker
+    
+    struct MarkerPool {
+        
+        using Page = Bag<const Object*>::Page;
+        
+        int marker_count;
+        std::unique_ptr<Marker[]> markers;
+        std::vector<std::thread> helpers;
+        
+        // The current round, published to the helpers by the generation
+        void (MarkerPool::*phase)(int) = nullptr;
+        std::vector<Page*> pages;
+        Atomic<size_t> next_page{0};
+        termination_detection_barrier* barrier = nullptr;
+        bool lazy = false;
+        bool stopping = false;
+        
+        Atomic<uint32_t> generation{0};
+        Atomic<uint32_t> running{0};
+        
+        explicit MarkerPool(int marker_count);
+        MarkerPool(const MarkerPool&) = delete;
+        ~MarkerPool();
+        MarkerPool& operator=(const MarkerPool&) = delete;
+        
+        // Sort the objects of the bag, which is left empty, and trace from
+        // the roots; returns the number of objects scanned
+        size_t mark_round(Bag<const Object*>& bag,
+                          const Object* const* first,
+                          const Object* const* last);
+        
+        // Sweep the objects of the bag, which is left empty, keeping the
+        // WHITE ones in the white bags if lazy
+        void sweep_round(Bag<const Object*>& bag, bool lazy);
+        
+        void run(void (MarkerPool::*phase)(int), Bag<const Object*>& bag);
+        void mark(int index);
+        void sweep(int index);
+        void helper_entry(int index);
+        
+    }; // struct MarkerPool
+    
     // Log of a Mutator's actions since the last handshake with the Collector
     
     struct Log {
         
         bool dirty;
-        Bag<const Object*> allocations;
+        // A page at a time, rather than an object at a time
+        Bag<heap_extent> allocations;
         std::intptr_t bytes_allocated;
         std::intptr_t bytes_deallocated;
         
@@ -233,6 +321,7 @@ namespace aaa::gc {
         };
         
         Atomic<intptr_t> reference_count{2};
+        uint64_t id;
         Channel* entrant_list_next = nullptr;
         Atomic<TaggedPtr<LogNode, Channel::Tag>> log_stack_head;
         
@@ -241,15 +330,39 @@ namespace aaa::gc {
         
     };
     
+    // Pacing
+    //
+    // Mutators report the bytes they allocate, less those they free, to the
+    // collector in chunks, and the sweeps report the bytes they free, so the
+    // collector can track the size of the heap without a handshake.  Between
+    // cycles it sleeps until the heap reaches the soft limit; the mutator
+    // whose report crosses it wakes the collector.  Above the hard limit,
+    // mutators pay for their allocations in mutator_handshake: they delete
+    // the dead objects left by a lazy sweep, and if that is not enough they
+    // wait for the collector to next ask them to handshake, or for the heap
+    // to fall back under the limit.  They cannot handshake more than once
+    // per call, because their caller must shade its roots after each
+    // handshake.  Whoever ends either wait while mutators are stalled
+    // advances the stall generation and wakes them all.
+    
+    constexpr std::intptr_t PACE_BYTES = 1 << 16;
+    
     // garbage collector state for one mutator thread
     
     struct Mutator {
         
         Channel* channel = nullptr;
         Log mutator_log;
+        // The collector's allocation color as of our last handshake, so
+        // that our allocations change color only when we handshake
+        std::underlying_type_t<Color> encoded_color_alloc = 0;
+        // Bytes we may allocate before reporting to the pacer
+        std::intptr_t pace_credit = PACE_BYTES;
         
         void publish_log_with_tag(Channel::Tag tag);
         
+        void pace();
+        void stall();
         void handshake();
         
         void enter();
@@ -257,45 +370,143 @@ namespace aaa::gc {
         
     };
     
+    // Telemetry
+    //
+    // The collector counts and times the cycle in progress, and, when
+    // tracing, records each phase and each handshake it awaits as an event,
+    // and publishes them all as the cycle ends.  Reading the clock a few
+    // times per phase and once per mutator per handshake round costs
+    // nothing next to the phases themselves.
+    
+    inline uint64_t now_ns() {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+    
+    struct TraceEvent {
+        const char* name;
+        uint64_t tid;
+        uint64_t begin_ns;
+        uint64_t duration_ns;
+    };
+    
+    // Minor cycles
+    //
+    // Most objects, such as the nodes of superseded versions of a persistent
+    // map, die young.  A minor cycle marks and sweeps only the objects
+    // allocated since the previous cycle began, and promotes the survivors
+    // to the old bag.  Instead of flipping the color encoding at its end,
+    // it leaves the old objects BLACK and has the mutators allocate WHITE
+    // again, so that the next minor cycle neither traces through nor sweeps
+    // the old objects.  A mutator allocates BLACK from its first handshake
+    // of a cycle to its last, and those objects are promoted unexamined, so
+    // the young generation is what each mutator allocates between cycles.
+    //
+    // An old object can only point to a young one if a mutator stored it
+    // there, and the store shades the young object GRAY, so the GRAY
+    // objects in the young bag are the remembered set: the minor cycle
+    // scans them along with the shaded roots.  The objects of immutable
+    // structures point only to objects older than themselves, and need
+    // nothing remembered.
+    //
+    // Every so often a whole-heap cycle ends the run of minor cycles, so
+    // that old objects that have died are reclaimed too.  The cycle before
+    // it flips the color encoding, turning the old objects WHITE again, and
+    // the whole-heap cycle collects the old and young bags together.
+    
     // garbage collector state for the unique collector thread, which is
     // also a mutator
     
     struct Collector : Mutator {
         
         // These variables are loaded by all threads very frequently (per shade
-        // and new), and only stored to by the collector infrequently (per
+        // and handshake), and only stored to by the collector infrequently (per
         // round of handshakes).  It should be beneficial to put them on their
         // own cache line so they are not frequently invalidated by writes to
         // hot fields of the collector such as .gray_stack.__end_.
         
-        struct alignas(CACHE_LINE_SIZE) {
-            Atomic<std::underlying_type_t<Color>> atomic_encoded_color_encoding;
-            Atomic<std::underlying_type_t<Color>> atomic_encoded_color_alloc;
-            // Ctrie* string_ctrie = nullptr;
-        };
+        alignas(CACHE_LINE_SIZE) Atomic<std::underlying_type_t<Color>> atomic_encoded_color_encoding;
+        Atomic<std::underlying_type_t<Color>> atomic_encoded_color_alloc;
+        // Ctrie* string_ctrie = nullptr;
+        
+        // Options take effect from the next cycle
+        std::mutex options_mutex;
+        collector_options pending_options;
+        collector_options options;
+        
+        // Pages of WHITE objects left by a lazy sweep, for the mutators to
+        // delete a page at a time as they allocate
+        alignas(CACHE_LINE_SIZE) Atomic<size_t> lazy_page_count;
+        std::mutex lazy_mutex;
+        Bag<const Object*>::Page* lazy_page_head = nullptr;
         
-        Atomic<Channel*> entrant_list_head;
+        // The pacer's view of the heap, in bytes allocated less freed, and
+        // its limits, or zero
+        alignas(CACHE_LINE_SIZE) Atomic<std::intptr_t> heap_bytes;
+        Atomic<std::intptr_t> heap_soft_limit;
+        Atomic<std::intptr_t> heap_hard_limit;
+        Atomic<uint32_t> sleeping;
+        Atomic<int> stalled_mutators;
+        Atomic<uint32_t> stall_generation;
+        // Set by collector_stop before it posts its request, so that we do
+        // not sleep through it
+        Atomic<bool> stopping;
+        
+        // Telemetry of the cycle in progress
+        collector_statistics cycle_stats = {};
+        uint64_t handshakes_requested_ns = 0;
+        std::vector<TraceEvent> cycle_events;
+        Atomic<bool> tracing;
+        
+        // Telemetry of the cycles ended
+        std::mutex stats_mutex;
+        collector_statistics stats_last = {};
+        collector_statistics stats_total = {};
+        std::vector<TraceEvent> trace_events;
+        
+        alignas(CACHE_LINE_SIZE) Atomic<Channel*> entrant_list_head;
         std::vector<Channel*> active_channels;
         Log collector_log;
         Bag<const Object*> object_bag;
         Bag<const Object*> white_bag;
         Bag<const Object*> black_bag;
-        std::vector<const Object*> gray_stack;
+        std::unique_ptr<MarkerPool> marker_pool;
         Bag<const Object*> red_bag;
+        // Survivors of minor cycles, BLACK until the next whole-heap cycle
+        Bag<const Object*> old_bag;
+        bool next_cycle_is_minor = false;
+        int minor_cycles_since_major = 0;
         bool stop_requested = false;
         
         void collect();
         
+        void apply_options();
+        void sleep_until_over_budget();
+        void report_bytes(std::intptr_t bytes);
+        void wake();
+        void unstall();
+        
+        void mark();
+        void sweep();
+        bool sweep_lazy_page();
+        
         void set_alloc_to_black();
+        void set_alloc_to_white();
         void flip_encoded_color_encoding();
         
         void consume_log_list(LogNode* log_list_head);
+        void adopt_allocations();
         
         void initiate_handshakes();
         void finalize_handshakes();
         
         void synchronize_with_mutators();
         
+        uint64_t end_phase(const char* name, uint64_t begin_ns, uint64_t& total_ns);
+        void record_handshake(const Channel* channel);
+        void publish_stats();
+        
+        void shutdown();
+        
         
     }; // struct Collector
     
@@ -303,13 +514,16 @@ namespace aaa::gc {
     
     
     thread_local Mutator* thread_local_mutator = nullptr;
+    thread_local Marker* thread_local_marker = nullptr;
     
     Collector* global_collector = nullptr;
     
     
     
+#if !AAA_GC_SIDE_TABLE_COLORS
+    
     AtomicEncodedColor::AtomicEncodedColor()
-    : _encoded(global_collector->atomic_encoded_color_alloc.load(Ordering::RELAXED)) {
+    : _encoded(thread_local_mutator->encoded_color_alloc) {
     }
     
     Color AtomicEncodedColor::load() const {
@@ -330,21 +544,75 @@ namespace aaa::gc {
         return result;
     }
     
+#else
+    
+    // Neighbouring objects share a word of the side table, so each change
+    // is a compare-exchange of the whole word that leaves the other colors
+    // as it found them
+    
+    AtomicEncodedColor::AtomicEncodedColor() {
+        uint64_t encoded_alloc = thread_local_mutator->encoded_color_alloc;
+        int shift = 0;
+        Atomic<uint64_t>& word = _heap_color_word(this, shift);
+        uint64_t expected = word.load(Ordering::RELAXED);
+        while (!word.compare_exchange_weak(expected,
+                                           (expected & ~((uint64_t)3 << shift)) | (encoded_alloc << shift),
+                                           Ordering::RELAXED,
+                                           Ordering::RELAXED))
+            ;
+    }
+    
+    Color AtomicEncodedColor::load() const {
+        std::underlying_type_t<Color> encoding = global_collector->atomic_encoded_color_encoding.load(Ordering::RELAXED);
+        int shift = 0;
+        uint64_t word = _heap_color_word(this, shift).load(Ordering::RELAXED);
+        return Color{(std::underlying_type_t<Color>)(((word >> shift) & 3) ^ encoding)};
+    }
+    
+    bool AtomicEncodedColor::compare_exchange(Color &expected, Color desired) {
+        std::underlying_type_t<Color> encoding = global_collector->atomic_encoded_color_encoding.load(Ordering::RELAXED);
+        uint64_t encoded_expected = std::to_underlying(expected) ^ encoding;
+        uint64_t encoded_desired = std::to_underlying(desired) ^ encoding;
+        int shift = 0;
+        Atomic<uint64_t>& word = _heap_color_word(this, shift);
+        uint64_t discovered = word.load(Ordering::RELAXED);
+        for (;;) {
+            uint64_t encoded_discovered = (discovered >> shift) & 3;
+            if (encoded_discovered != encoded_expected) {
+                expected = gc::Color{(std::underlying_type_t<Color>)(encoded_discovered ^ encoding)};
+                return false;
+            }
+            if (word.compare_exchange_weak(discovered,
+                                           (discovered & ~((uint64_t)3 << shift)) | (encoded_desired << shift),
+                                           Ordering::RELAXED,
+                                           Ordering::RELAXED))
+                return true;
+        }
+    }
+    
+#endif
+    
     
     
     void* Object::operator new(size_t count) {
-        void* ptr = calloc(count, 1);
-        thread_local_mutator->mutator_log.bytes_allocated += count;
+        if (global_collector->lazy_page_count.load(Ordering::RELAXED)) [[unlikely]]
+            (void) global_collector->sweep_lazy_page();
+        void* ptr = heap_allocate(count);
+        heap_log(ptr);
+        Mutator* mutator = thread_local_mutator;
+        mutator->mutator_log.bytes_allocated += count;
+        if ((mutator->pace_credit -= _heap_page_of(ptr)->block_size) < 0) [[unlikely]]
+            mutator->pace();
         return ptr;
     }
     
     void Object::operator delete(void* ptr) {
-        free(ptr);
+        heap_deallocate(ptr);
     }
     
+    // Logged by operator new, which must have allocated every Object
     Object::Object()
     : color() {
-        thread_local_mutator->mutator_log.allocations.push(this);
     }
     
     void Object::_object_shade() const {
@@ -369,7 +637,7 @@ namespace aaa::gc {
         (void) color.compare_exchange(expected, Color::BLACK);
         switch (expected) {
             case Color::WHITE:
-                global_collector->gray_stack.push_back(this);
+                thread_local_marker->gray.push(this);
                 break;
             case Color::BLACK:
             case Color::GRAY:
@@ -424,8 +692,12 @@ namespace aaa::gc {
     
     
     
+    // Numbers the channels, and so the mutators, in telemetry
+    Atomic<uint64_t> _channel_count;
+    
     Channel::Channel()
     : reference_count(2)
+    , id(_channel_count.add_fetch(1, Ordering::RELAXED))
     , entrant_list_next(nullptr)
     , log_stack_head(TaggedPtr((LogNode*)nullptr,
                                Channel::Tag::NOTHING)) {
@@ -443,6 +715,9 @@ namespace aaa::gc {
     void Mutator::publish_log_with_tag(Channel::Tag tag) {
         assert(thread_local_mutator == this);
         assert(channel);
+        heap_publish_log([this](const heap_extent& extent) {
+            mutator_log.allocations.push(extent);
+        });
         LogNode* node = new LogNode(std::move(this->mutator_log));
         assert(this->mutator_log.dirty == false);
         TaggedPtr desired(node, tag);
@@ -469,7 +744,43 @@ namespace aaa::gc {
         }
     }
     
+    void Mutator::pace() {
+        std::intptr_t bytes = PACE_BYTES - std::exchange(pace_credit, PACE_BYTES);
+        global_collector->report_bytes(bytes);
+    }
+    
+    void Mutator::stall() {
+        Collector* collector = global_collector;
+        auto over = [collector]() {
+            std::intptr_t limit = collector->heap_hard_limit.load(Ordering::SEQ_CST);
+            return limit && (collector->heap_bytes.load(Ordering::SEQ_CST) >= limit);
+        };
+        pace();
+        // Help with the sweep
+        while (over() && collector->sweep_lazy_page())
+            ;
+        if (!over())
+            return;
+        // Wait for the collector to ask us to handshake, or for the heap to
+        // fall under the limit.  Having counted ourself stalled, we check
+        // both after reading the generation, so whoever changes either after
+        // our check sees us counted and advances it
+        collector->stalled_mutators.add_fetch(1, Ordering::SEQ_CST);
+        collector->wake();
+        for (;;) {
+            uint32_t generation = collector->stall_generation.load(Ordering::SEQ_CST);
+            TaggedPtr expected(channel->log_stack_head.load(Ordering::SEQ_CST));
+            if ((expected.tag != Channel::Tag::NOTHING) || !over())
+                break;
+            collector->stall_generation.wait(generation, Ordering::ACQUIRE);
+        }
+        collector->stalled_mutators.sub_fetch(1, Ordering::RELAXED);
+    }
+    
     void Mutator::handshake() {
+        std::intptr_t limit = global_collector->heap_hard_limit.load(Ordering::RELAXED);
+        if (limit && (global_collector->heap_bytes.load(Ordering::RELAXED) >= limit) && (this != global_collector)) [[unlikely]]
+            stall();
         TaggedPtr expected(channel->log_stack_head.load(Ordering::ACQUIRE));
         switch (expected.tag) {
             case Channel::Tag::NOTHING:
@@ -477,6 +788,7 @@ namespace aaa::gc {
             case Channel::Tag::COLLECTOR_DID_REQUEST_HANDSHAKE:
             case Channel::Tag::COLLECTOR_DID_REQUEST_WAKEUP:
                 publish_log_with_tag(Channel::Tag::MUTATOR_DID_PUBLISH_LOGS);
+                encoded_color_alloc = global_collector->atomic_encoded_color_alloc.load(Ordering::RELAXED);
                 break;
             case Channel::Tag::COLLECTOR_DID_REQUEST_MUTATOR_LEAVES:
                 leave();
@@ -499,18 +811,197 @@ namespace aaa::gc {
         next = head.load(Ordering::ACQUIRE);
         while (!head.compare_exchange_strong(next,
                                              channel,
-                                             Ordering::RELEASE,
+                                             Ordering::ACQ_REL,
                                              Ordering::ACQUIRE))
             ;
+        // Either the collector has yet to take our channel, and will ask
+        // us to handshake after any change, or it has released the change
+        // to us by taking the list before ours
+        encoded_color_alloc = global_collector->atomic_encoded_color_alloc.load(Ordering::RELAXED);
     }
     
     void Mutator::leave() {
+        pace();
         publish_log_with_tag(Channel::Tag::MUTATOR_DID_LEAVE);
         std::exchange(channel, nullptr)->release();
     }
     
     
     
+    MarkerPool::MarkerPool(int marker_count)
+    : marker_count(marker_count)
+    , markers(new Marker[marker_count]) {
+        assert(marker_count > 0);
+        for (int index = 1; index != marker_count; ++index)
+            helpers.emplace_back([this, index]() { helper_entry(index); });
+    }
+    
+    MarkerPool::~MarkerPool() {
+        stopping = true;
+        generation.add_fetch(1, Ordering::RELEASE);
+        generation.notify_all();
+        for (std::thread& helper : helpers)
+            helper.join();
+    }
+    
+    void MarkerPool::run(void (MarkerPool::*phase)(int), Bag<const Object*>& bag) {
+        for (Page* page = bag.release(); page; page = page->next)
+            pages.push_back(page);
+        next_page.store(0, Ordering::RELAXED);
+        this->phase = phase;
+        running.store(marker_count - 1, Ordering::RELAXED);
+        generation.add_fetch(1, Ordering::RELEASE);
+        generation.notify_all();
+        (this->*phase)(0);
+        uint32_t expected = running.load(Ordering::ACQUIRE);
+        while (expected)
+            running.wait(expected, Ordering::ACQUIRE);
+        pages.clear();
+    }
+    
+    size_t MarkerPool::mark_round(Bag<const Object*>& bag,
+                                  const Object* const* first,
+                                  const Object* const* last) {
+        termination_detection_barrier round_barrier(marker_count);
+        barrier = &round_barrier;
+        thread_local_marker = &markers[0];
+        for (; first != last; ++first)
+            object_trace(*first);
+        run(&MarkerPool::mark, bag);
+        barrier = nullptr;
+        thread_local_marker = nullptr;
+        // No thief remains to read the arrays the deques outgrew
+        size_t scanned = 0;
+        for (int index = 0; index != marker_count; ++index) {
+            Marker& marker = markers[index];
+            work_stealing_deque<const Object*>::free_retired(marker.gray.take_retired());
+            scanned += std::exchange(marker.scanned, 0);
+        }
+        return scanned;
+    }
+    
+    void MarkerPool::sweep_round(Bag<const Object*>& bag, bool lazy) {
+        this->lazy = lazy;
+        run(&MarkerPool::sweep, bag);
+    }
+    
+    void MarkerPool::mark(int index) {
+        Marker& self = markers[index];
+        thread_local_marker = &self;
+        const Object* object = nullptr;
+        auto drain = [&]() {
+            while (self.gray.pop(object)) {
+                object->_object_scan();
+                ++self.scanned;
+            }
+        };
+        for (;;) {
+            size_t i = next_page.add_fetch(1, Ordering::RELAXED) - 1;
+            if (i >= pages.size())
+                break;
+            Page* page = pages[i];
+            for (size_t j = 0; j != page->size(); ++j) {
+                object = page->elements[j];
+                assert(object);
+                Color expected = Color::GRAY;
+                object->color.compare_exchange(expected, Color::BLACK);
+                switch (expected) {
+                    case Color::WHITE:
+                        // Object is WHITE (but may turn GRAY at any time)
+                        self.white_bag.push(object);
+                        break;
+                    case Color::GRAY:
+                        // Was GRAY and is now BLACK
+                        // Scan its fields to restore the invariant
+                        object->_object_scan();
+                        ++self.scanned;
+                        [[fallthrough]];
+                    case Color::BLACK:
+                        // Is BLACK and will remain so
+                        self.black_bag.push(object);
+                        break;
+                    case Color::RED:
+                    default:
+                        // "Impossible"
+                        object_debug(object);
+                        abort();
+                }
+                // Depth first tracing
+                drain();
+            }
+            delete page;
+        }
+        drain();
+        // Out of work of our own; steal until nobody has any
+        barrier->set_inactive();
+        while (!barrier->is_terminated()) {
+            for (int k = 1; k != marker_count; ++k) {
+                Marker& victim = markers[(index + k) % marker_count];
+                if (!victim.gray.can_steal())
+                    continue;
+                barrier->set_active();
+                if (victim.gray.steal_half(object, self.gray)) {
+                    object->_object_scan();
+                    ++self.scanned;
+                    drain();
+                }
+                barrier->set_inactive();
+            }
+            std::this_thread::yield();
+        }
+    }
+    
+    void MarkerPool::sweep(int index) {
+        Marker& self = markers[index];
+        for (;;) {
+            size_t i = next_page.add_fetch(1, Ordering::RELAXED) - 1;
+            if (i >= pages.size())
+                break;
+            Page* page = pages[i];
+            for (size_t j = 0; j != page->size(); ++j) {
+                const Object* object = page->elements[j];
+                switch (object->_object_sweep()) {
+                    case Color::WHITE:
+                        if (lazy) {
+                            self.white_bag.push(object);
+                        } else {
+                            self.bytes_freed += _heap_page_of(object)->block_size;
+                            delete object;
+                        }
+                        break;
+                    case Color::BLACK:
+                        self.black_bag.push(object);
+                        break;
+                    case Color::RED:
+                        self.red_bag.push(object);
+                        break;
+                    case Color::GRAY:
+                    default:
+                        object_debug(object);
+                        abort();
+                }
+            }
+            delete page;
+        }
+    }
+    
+    void MarkerPool::helper_entry(int index) {
+        uint32_t seen = 0;
+        for (;;) {
+            uint32_t discovered = seen;
+            while (discovered == seen)
+                generation.wait(discovered, Ordering::ACQUIRE);
+            seen = discovered;
+            if (stopping)
+                return;
+            (this->*phase)(index);
+            if (running.sub_fetch(1, Ordering::RELEASE) == 0)
+                running.notify_one();
+        }
+    }
+    
+    
+    
     void Collector::flip_encoded_color_encoding() {
         std::underlying_type_t<Color> encoding = atomic_encoded_color_encoding.load(Ordering::RELAXED);
         atomic_encoded_color_encoding.store(encoding ^ 1, Ordering::RELAXED);
@@ -522,6 +1013,12 @@ namespace aaa::gc {
         atomic_encoded_color_alloc.store(encoded_black, Ordering::RELAXED);
     }
     
+    void Collector::set_alloc_to_white() {
+        std::underlying_type_t<Color> encoding = atomic_encoded_color_encoding.load(Ordering::RELAXED);
+        std::underlying_type_t<Color> encoded_white = std::to_underlying(Color::WHITE) ^ encoding;
+        atomic_encoded_color_alloc.store(encoded_white, Ordering::RELAXED);
+    }
+    
     void Collector::consume_log_list(LogNode* log_list_head) {
         while (log_list_head) {
             auto a = log_list_head->log_list_next;
@@ -534,6 +1031,19 @@ namespace aaa::gc {
         }
     }
     
+    // Read the objects out of the extents the mutators have handed over,
+    // before we can free any of them, and so before their pages' logs can
+    // wrap around onto them
+    void Collector::adopt_allocations() {
+        while (!collector_log.allocations.empty()) {
+            heap_extent extent = collector_log.allocations.top();
+            collector_log.allocations.pop();
+            heap_extent_for_each(extent, [this](void* q) {
+                object_bag.push((const Object*)q);
+            });
+        }
+    }
+    
     void Collector::initiate_handshakes() {
         auto first = active_channels.begin();
         auto last = active_channels.end();
@@ -557,6 +1067,17 @@ namespace aaa::gc {
                         std::swap(*first, *last);
                     break;
                 }
+                case Channel::Tag::MUTATOR_DID_REQUEST_COLLECTOR_STOPS: {
+                    this->stop_requested = true;
+                    LogNode* log_list_head = discovered.ptr;
+                    assert(log_list_head);
+                    consume_log_list(log_list_head);
+                    std::exchange(channel, nullptr)->release();
+                    --last;
+                    if (first != last)
+                        std::swap(*first, *last);
+                    break;
+                }
                 default: {
                     abort();
                 }
@@ -590,7 +1111,7 @@ namespace aaa::gc {
                         case AtomicWaitResult::NO_TIMEOUT:
                             break;
                         case AtomicWaitResult::TIMEOUT:
-                            fprintf(stderr, "Mutator unresponsive (1s)\n");
+                            fprintf(stderr, "Mutator %" PRIu64 " unresponsive (1s)\n", channel->id);
                             break;
                         default:
                             abort();
@@ -603,13 +1124,16 @@ namespace aaa::gc {
                     if (channel->log_stack_head.compare_exchange_strong(expected,
                                                                         desired,
                                                                         Ordering::RELAXED,
-                                                                        Ordering::ACQUIRE))
+                                                                        Ordering::ACQUIRE)) {
+                        record_handshake(channel);
                         ++first;
+                    }
                     break;
                 }
                 case Channel::Tag::MUTATOR_DID_LEAVE: {
                     LogNode* log_list_head = expected.ptr;
                     consume_log_list(log_list_head);
+                    record_handshake(channel);
                     channel->release();
                     --last;
                     if (first != last)
@@ -620,6 +1144,7 @@ namespace aaa::gc {
                     this->stop_requested = true;
                     LogNode* log_list_head = expected.ptr;
                     consume_log_list(log_list_head);
+                    record_handshake(channel);
                     channel->release();
                     --last;
                     if (first != last)
@@ -635,6 +1160,8 @@ namespace aaa::gc {
     }
     
     void Collector::synchronize_with_mutators() {
+        handshakes_requested_ns = now_ns();
+        
         // Acquire entering mutators and release any changes to the color
         // encoding or alloc color
         Channel* head = entrant_list_head.exchange(nullptr, Ordering::ACQ_REL);
@@ -648,8 +1175,10 @@ namespace aaa::gc {
         }
         
         // Use the channels to request that each mutator synchronizes with us
-        // at its convenience
+        // at its convenience, and wake any that stalled waiting for the
+        // request
         initiate_handshakes();
+        unstall();
         
         // Handshake ourself and shade our own root gc::objects
         this->handshake();
@@ -658,6 +1187,164 @@ namespace aaa::gc {
         // Wait for every mutator to handshake or leave
         finalize_handshakes();
         
+        (void) end_phase("synchronize", handshakes_requested_ns, cycle_stats.synchronize_ns);
+    }
+    
+    uint64_t Collector::end_phase(const char* name, uint64_t begin_ns, uint64_t& total_ns) {
+        uint64_t end_ns = now_ns();
+        total_ns += end_ns - begin_ns;
+        if (tracing.load(Ordering::RELAXED))
+            cycle_events.push_back(TraceEvent{name, 0, begin_ns, end_ns - begin_ns});
+        return end_ns;
+    }
+    
+    void Collector::record_handshake(const Channel* channel) {
+        uint64_t latency_ns = now_ns() - handshakes_requested_ns;
+        ++cycle_stats.handshakes;
+        cycle_stats.handshake_total_ns += latency_ns;
+        cycle_stats.handshake_max_ns = std::max(cycle_stats.handshake_max_ns, latency_ns);
+        if (tracing.load(Ordering::RELAXED))
+            cycle_events.push_back(TraceEvent{"handshake", channel->id, handshakes_requested_ns, latency_ns});
+    }
+    
+    void Collector::publish_stats() {
+        cycle_stats.cycles = 1;
+        cycle_stats.bytes_allocated = (uint64_t)std::exchange(collector_log.bytes_allocated, 0);
+        std::unique_lock lock{stats_mutex};
+        stats_last = cycle_stats;
+        collector_statistics& total = stats_total;
+        total.cycles += cycle_stats.cycles;
+        total.minor_cycles += cycle_stats.minor_cycles;
+        total.live = cycle_stats.live;
+        total.freed += cycle_stats.freed;
+        total.red += cycle_stats.red;
+        total.rounds += cycle_stats.rounds;
+        total.bytes_allocated += cycle_stats.bytes_allocated;
+        total.handshakes += cycle_stats.handshakes;
+        total.handshake_total_ns += cycle_stats.handshake_total_ns;
+        total.handshake_max_ns = std::max(total.handshake_max_ns, cycle_stats.handshake_max_ns);
+        total.sleep_ns += cycle_stats.sleep_ns;
+        total.synchronize_ns += cycle_stats.synchronize_ns;
+        total.mark_ns += cycle_stats.mark_ns;
+        total.sweep_ns += cycle_stats.sweep_ns;
+        total.reclaim_ns += cycle_stats.reclaim_ns;
+        total.cycle_ns += cycle_stats.cycle_ns;
+        trace_events.insert(trace_events.end(), cycle_events.begin(), cycle_events.end());
+        cycle_events.clear();
+        cycle_stats = {};
+    }
+    
+    void Collector::mark() {
+        (void) marker_pool->mark_round(object_bag, nullptr, nullptr);
+        for (int index = 0; index != marker_pool->marker_count; ++index) {
+            Marker& marker = marker_pool->markers[index];
+            white_bag.splice(std::move(marker.white_bag));
+            black_bag.splice(std::move(marker.black_bag));
+        }
+    }
+    
+    void Collector::sweep() {
+        // Whatever the mutators did not get to since the last sweep
+        while (sweep_lazy_page())
+            ;
+        marker_pool->sweep_round(object_bag, options.lazy_sweep);
+        Bag<const Object*> dead;
+        std::intptr_t bytes_freed = 0;
+        for (int index = 0; index != marker_pool->marker_count; ++index) {
+            Marker& marker = marker_pool->markers[index];
+            bytes_freed += std::exchange(marker.bytes_freed, 0);
+            dead.splice(std::move(marker.white_bag));
+            black_bag.splice(std::move(marker.black_bag));
+            red_bag.splice(std::move(marker.red_bag));
+        }
+        report_bytes(-bytes_freed);
+        if (dead.empty())
+            return;
+        size_t count = 0;
+        Bag<const Object*>::Page* tail = nullptr;
+        Bag<const Object*>::Page* head = dead.release();
+        for (Bag<const Object*>::Page* page = head; page; page = page->next) {
+            tail = page;
+            ++count;
+        }
+        std::unique_lock lock{lazy_mutex};
+        tail->next = std::exchange(lazy_page_head, head);
+        lazy_page_count.add_fetch(count, Ordering::RELAXED);
+    }
+    
+    bool Collector::sweep_lazy_page() {
+        Bag<const Object*>::Page* page = nullptr;
+        {
+            std::unique_lock lock{lazy_mutex};
+            page = lazy_page_head;
+            if (!page)
+                return false;
+            lazy_page_head = page->next;
+            lazy_page_count.sub_fetch(1, Ordering::RELAXED);
+        }
+        std::intptr_t bytes_freed = 0;
+        for (size_t j = 0; j != page->size(); ++j) {
+            bytes_freed += _heap_page_of(page->elements[j])->block_size;
+            delete page->elements[j];
+        }
+        delete page;
+        report_bytes(-bytes_freed);
+        return true;
+    }
+    
+    void Collector::report_bytes(std::intptr_t bytes) {
+        std::intptr_t size = heap_bytes.add_fetch(bytes, Ordering::SEQ_CST);
+        std::intptr_t limit = heap_soft_limit.load(Ordering::RELAXED);
+        if ((bytes > 0) && (size >= limit) && (size - bytes < limit))
+            wake();
+        if (bytes < 0) {
+            std::intptr_t hard_limit = heap_hard_limit.load(Ordering::RELAXED);
+            if (!hard_limit || (size < hard_limit))
+                unstall();
+        }
+    }
+    
+    void Collector::wake() {
+        if (sleeping.exchange(0, Ordering::SEQ_CST))
+            sleeping.notify_one();
+    }
+    
+    void Collector::unstall() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (stalled_mutators.load(Ordering::SEQ_CST)) {
+            stall_generation.add_fetch(1, Ordering::RELEASE);
+            stall_generation.notify_all();
+        }
+    }
+    
+    void Collector::apply_options() {
+        {
+            std::unique_lock lock{options_mutex};
+            options = pending_options;
+        }
+        heap_soft_limit.store((std::intptr_t)options.soft_limit, Ordering::RELAXED);
+        heap_hard_limit.store((std::intptr_t)options.hard_limit, Ordering::SEQ_CST);
+        // a new hard limit may release the stalled
+        unstall();
+    }
+    
+    // Any crossing of the soft limit, stall, or change of options that
+    // follows our announcing that we sleep will wake us
+    void Collector::sleep_until_over_budget() {
+        for (;;) {
+            apply_options();
+            if (!options.soft_limit)
+                return;
+            uint32_t expected = 1;
+            sleeping.store(expected, Ordering::SEQ_CST);
+            if ((heap_bytes.load(Ordering::SEQ_CST) >= (std::intptr_t)options.soft_limit)
+                || stalled_mutators.load(Ordering::SEQ_CST)
+                || stopping.load(Ordering::SEQ_CST)) {
+                sleeping.store(0, Ordering::RELAXED);
+                return;
+            }
+            sleeping.wait(expected, Ordering::ACQUIRE);
+        }
     }
     
     void Collector::collect() {
@@ -666,19 +1353,42 @@ namespace aaa::gc {
         
         for (;;) {
             
+            // Once asked to stop, finish the cycles that the other mutators
+            // need to leave, until only we remain
+            
+            if (stop_requested
+                && (active_channels.size() == 1)
+                && !entrant_list_head.load(Ordering::ACQUIRE))
+                return shutdown();
+            
+            // Sleep while the heap is under budget
+            
+            uint64_t begin_ns = now_ns();
+            sleep_until_over_budget();
+            uint64_t cycle_begin_ns = end_phase("sleep", begin_ns, cycle_stats.sleep_ns);
+            if (!marker_pool || (marker_pool->marker_count != options.marker_count))
+                marker_pool = std::make_unique<MarkerPool>(options.marker_count);
+            
             assert(black_bag.empty());
             assert(white_bag.empty());
-            assert(gray_stack.empty());
             assert(red_bag.empty());
             
             // All mutators are allocating WHITE
             // The write barrier is shading WHITE objects GRAY
             
+            // A minor cycle collects only the young objects; the old ones
+            // are BLACK and stay out of the way
+            
+            bool minor = std::exchange(next_cycle_is_minor, false);
+            if (!minor)
+                object_bag.splice(std::move(old_bag));
+            cycle_stats.minor_cycles = minor;
+            
             // Change alloc color from WHITE to BLACK
             
             set_alloc_to_black();
             synchronize_with_mutators();
-            object_bag.splice(std::move(collector_log.allocations));
+            adopt_allocations();
             collector_log.dirty = false;
             
             // All objects allocated since the handshake will be BLACK and are
@@ -692,40 +1402,10 @@ namespace aaa::gc {
             
             for (;;) {
                 
-                while (!object_bag.empty()) {
-                    const Object* object = object_bag.top();
-                    object_bag.pop();
-                    assert(object);
-                    Color expected = Color::GRAY;
-                    object->color.compare_exchange(expected, Color::BLACK);
-                    switch (expected) {
-                        case Color::WHITE:
-                            // Object is WHITE (but may turn GRAY at any time)
-                            white_bag.push(object);
-                            break;
-                        case Color::GRAY:
-                            // Was GRAY and is now BLACK
-                            // Scan its fields to restore the invariant
-                            object->_object_scan();
-                            [[fallthrough]];
-                        case Color::BLACK:
-                            // Is BLACK and will remain so
-                            black_bag.push(object);
-                            break;
-                        case Color::RED:
-                        default:
-                            // "Impossible"
-                            object_debug(object);
-                            abort();
-                    }
-                    while (!gray_stack.empty()) {
-                        // Depth first tracing
-                        const Object* object = gray_stack.back();
-                        gray_stack.pop_back();
-                        assert(object);
-                        object->_object_scan();
-                    }
-                }
+                begin_ns = now_ns();
+                mark();
+                (void) end_phase("mark", begin_ns, cycle_stats.mark_ns);
+                ++cycle_stats.rounds;
                 
                 // Note that some of the objects we put in the white bag
                 // may have been turned GRAY or BLACK by a mutator, or BLACK by
@@ -757,36 +1437,40 @@ namespace aaa::gc {
             
             
             // Sweep
-            while (!object_bag.empty()) {
-                const Object* object = object_bag.top();
-                object_bag.pop();
-                switch (object->_object_sweep()) {
-                    case Color::WHITE:
-                        delete object;
-                        break;
-                    case Color::BLACK:
-                        black_bag.push(object);
-                        break;
-                    case Color::RED:
-                        red_bag.push(object);
-                        break;
-                    case Color::GRAY:
-                    default:
-                        object_debug(object);
-                        abort();
-                }
-            }
+            begin_ns = now_ns();
+            size_t swept = object_bag.size();
+            size_t marked = black_bag.size();
+            sweep();
+            (void) end_phase("sweep", begin_ns, cycle_stats.sweep_ns);
+            cycle_stats.red = red_bag.size();
+            cycle_stats.freed = swept - (black_bag.size() - marked) - red_bag.size();
             
-            object_bag.swap(black_bag);
+            old_bag.splice(std::move(black_bag));
+            cycle_stats.live = old_bag.size();
             
             // All objects are BLACK or RED
             // All mutators are allocating BLACK
             // There are no WHITE or GRAY objects
             // Mutators may be dereferencing RED objects
             
-            // Redefine WHITE as BLACK
-            
-            flip_encoded_color_encoding();
+            if (minor)
+                ++minor_cycles_since_major;
+            else
+                minor_cycles_since_major = 0;
+            if (minor_cycles_since_major < options.minor_cycles) {
+                
+                // Keep the survivors BLACK, and so old, and allocate WHITE
+                
+                next_cycle_is_minor = true;
+                set_alloc_to_white();
+                
+            } else {
+                
+                // Redefine WHITE as BLACK
+                
+                flip_encoded_color_encoding();
+                
+            }
             synchronize_with_mutators();
             
             // All mutators are allocating WHITE
@@ -795,21 +1479,66 @@ namespace aaa::gc {
             
             // Delete all RED objects
             
+            begin_ns = now_ns();
+            std::intptr_t bytes_freed = 0;
             while (!red_bag.empty()) {
                 const Object* object = red_bag.top();
                 red_bag.pop();
+                bytes_freed += _heap_page_of(object)->block_size;
                 delete object;
             }
+            report_bytes(-bytes_freed);
             
             // All mutators are allocating WHITE
             // Write barrier turns WHITE objects GRAY or BLACK
             // There are no RED objects
             assert(red_bag.empty());
             
+            // Release the pages the sweep emptied
+            
+            heap_sweep_pages();
+            (void) end_phase("reclaim", begin_ns, cycle_stats.reclaim_ns);
+            
+            (void) end_phase("cycle", cycle_begin_ns, cycle_stats.cycle_ns);
+            publish_stats();
+            
         } // for(;;)
         
     } // void Collector::collect()
     
+    // Every other mutator has left, and nothing can reach the objects but
+    // their own fields, so we can delete them all in any order
+    void Collector::shutdown() {
+        
+        // Hand over our own log, and take it back as we release our channel
+        
+        Mutator::leave();
+        initiate_handshakes();
+        assert(active_channels.empty());
+        adopt_allocations();
+        
+        // Delete every object
+        
+        while (sweep_lazy_page())
+            ;
+        object_bag.splice(std::move(old_bag));
+        std::intptr_t bytes_freed = 0;
+        while (!object_bag.empty()) {
+            const Object* object = object_bag.top();
+            object_bag.pop();
+            bytes_freed += _heap_page_of(object)->block_size;
+            delete object;
+        }
+        report_bytes(-bytes_freed);
+        collector_log.dirty = false;
+        collector_log.bytes_allocated = 0;
+        collector_log.bytes_deallocated = 0;
+        
+        marker_pool.reset();
+        heap_sweep_pages();
+        
+    } // void Collector::shutdown()
+    
     
     
     void mutator_enter() {
@@ -822,17 +1551,43 @@ namespace aaa::gc {
         thread_local_mutator->handshake();
     }
     
+    bool mutator_is_entered() {
+        return thread_local_mutator && thread_local_mutator->channel;
+    }
+    
     void mutator_leave() {
         thread_local_mutator->leave();
     }
     
-    // todo: move these into the Collector object?
+    void mutator_exit() {
+        if (mutator_is_entered())
+            thread_local_mutator->leave();
+        delete std::exchange(thread_local_mutator, nullptr);
+    }
+    
+    void* allocate(std::size_t bytes) {
+        void* ptr = heap_allocate(bytes);
+        Mutator* mutator = thread_local_mutator;
+        mutator->mutator_log.bytes_allocated += bytes;
+        if ((mutator->pace_credit -= _heap_page_of(ptr)->block_size) < 0) [[unlikely]]
+            mutator->pace();
+        return ptr;
+    }
+    
+    void deallocate(void* ptr, std::size_t bytes) {
+        if (ptr)
+            thread_local_mutator->pace_credit += _heap_page_of(ptr)->block_size;
+        heap_deallocate(ptr);
+        thread_local_mutator->mutator_log.bytes_deallocated += bytes;
+    }
+    
+    // todo: move this into the Collector object?
     std::thread _collector_thread;
-    Atomic<bool> _collector_done;
     
-    void collector_start() {
+    void collector_start(collector_options options) {
         assert(global_collector == nullptr);
         global_collector = new gc::Collector;
+        global_collector->pending_options = options;
         thread_local_mutator = global_collector;
         thread_local_mutator->enter();
         // global_collector->string_ctrie = new Ctrie;
@@ -846,25 +1601,82 @@ namespace aaa::gc {
     }
     
     void collector_stop() {
-        _Exit(EXIT_SUCCESS);
-        
-        // The collector will be waiting on various mutators, including itself
-        // and the main thread
-        
-        // We will be posting stop from a mutator thread, in particular the
-        // main thread.
-        
-        // So the best way to stop the collector is to use the mutator to post
-        // that status
-        
-        // If we want to start-stop-start the collector then we have to
-        // keep the global collector state around to run on cumulatively
+        // Post the request from a channel of our own, which the collector
+        // takes as our leaving, with whatever we allocated since we last
+        // left
+        if (!mutator_is_entered())
+            mutator_enter();
+        Mutator* mutator = thread_local_mutator;
+        global_collector->stopping.store(true, Ordering::SEQ_CST);
+        mutator->pace();
+        mutator->publish_log_with_tag(Channel::Tag::MUTATOR_DID_REQUEST_COLLECTOR_STOPS);
+        std::exchange(mutator->channel, nullptr)->release();
+        global_collector->wake();
         
-        // If we want to do parallel mark or sweep we need to make the collector
-        // objects a bit more thread safe
+        // The collector finishes its cycle, waits for any other mutators
+        // to leave, deletes every object and exits, retiring its heap pages
+        _collector_thread.join();
+        delete std::exchange(thread_local_mutator, nullptr);
+        delete std::exchange(global_collector, nullptr);
         
-        // _collector_done.store(true, Ordering::RELAXED);
-        // _collector_thread.join();
+        // Hand back the pages we hold, now empty, and the reserve
+        heap_flush();
+        heap_sweep_pages();
+        heap_trim();
+    }
+    
+    void collector_configure(collector_options options) {
+        {
+            std::unique_lock lock{global_collector->options_mutex};
+            global_collector->pending_options = options;
+        }
+        global_collector->wake();
+    }
+    
+    size_t trace(const Object* const* first, const Object* const* last, int marker_count) {
+        MarkerPool pool(marker_count);
+        Bag<const Object*> nothing;
+        return pool.mark_round(nothing, first, last);
+    }
+    
+    collector_statistics collector_stats() {
+        std::unique_lock lock{global_collector->stats_mutex};
+        return global_collector->stats_last;
+    }
+    
+    collector_statistics collector_stats_total() {
+        std::unique_lock lock{global_collector->stats_mutex};
+        return global_collector->stats_total;
+    }
+    
+    void collector_trace(bool enabled) {
+        global_collector->tracing.store(enabled, Ordering::RELAXED);
+    }
+    
+    void collector_trace_dump(FILE* file) {
+        std::vector<TraceEvent> events;
+        {
+            std::unique_lock lock{global_collector->stats_mutex};
+            events.swap(global_collector->trace_events);
+        }
+        fprintf(file, "[");
+        const char* separator = "\n";
+        for (const TraceEvent& event : events) {
+            fprintf(file,
+                    "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":%" PRIu64
+                    ",\"ts\":%" PRIu64 ".%03" PRIu64 ",\"dur\":%" PRIu64 ".%03" PRIu64 "}",
+                    separator,
+                    event.name,
+                    event.tid,
+                    event.begin_ns / 1000, event.begin_ns % 1000,
+                    event.duration_ns / 1000, event.duration_ns % 1000);
+            separator = ",\n";
+        }
+        fprintf(file, "\n]\n");
+    }
+    
+    std::intptr_t collector_heap_bytes() {
+        return global_collector->heap_bytes.load(Ordering::RELAXED);
     }
     
     bool collector_this_thread_is_collector_thread() {
@@ -9,13 +9,82 @@
 #define gc_hpp
 
 #include <cstddef>
+#include <cstdint>
+#include <cstdio>
 
 namespace aaa::gc {
     
-    void collector_start();
+    struct Object;
+    
+    struct collector_options {
+        // threads sharing each round of marking and each sweep, including
+        // the collector
+        int marker_count = 1;
+        // leave the deletion of dead objects to the mutators, each
+        // deleting a page's worth when it next allocates
+        bool lazy_sweep = false;
+        // between whole-heap cycles, run this many minor cycles, which
+        // collect only the objects allocated since the last cycle and
+        // promote the survivors, leaving them for the next whole-heap cycle
+        int minor_cycles = 0;
+        // sleep between cycles until the heap holds this many bytes; zero
+        // runs cycles back to back
+        std::size_t soft_limit = 0;
+        // above this many bytes, make mutators help the collector and then
+        // wait for it when they handshake; zero for no limit
+        std::size_t hard_limit = 0;
+    };
+    
+    void collector_start(collector_options options = {});
+    // Change the options, from the next cycle
+    void collector_configure(collector_options options);
     bool collector_this_thread_is_collector_thread();
+    // Bytes of gc::Objects allocated and not yet freed, as reported to the
+    // pacer; it lags each mutator by up to 64 KiB
+    std::intptr_t collector_heap_bytes();
+    // Once every other mutator has left, finish the cycle, delete every
+    // gc::Object and join the collector; the heap is then empty, and the
+    // collector may be started again
     void collector_stop();
     
+    // Telemetry of collection cycles, kept by the collector thread and
+    // published as each cycle ends.  Durations are in nanoseconds of the
+    // collector's wall clock; a handshake's latency runs from the request
+    // to the collector seeing the mutator's answer
+    
+    struct collector_statistics {
+        uint64_t cycles;             // 1 for a single cycle
+        uint64_t minor_cycles;
+        uint64_t live;               // objects held once the cycle ends
+        uint64_t freed;              // WHITE objects swept
+        uint64_t red;                // RED objects deleted
+        uint64_t rounds;             // of marking, until no mutator is dirty
+        uint64_t bytes_allocated;    // as logged by the mutators
+        uint64_t handshakes;         // answered by a mutator, or its leaving
+        uint64_t handshake_total_ns;
+        uint64_t handshake_max_ns;
+        uint64_t sleep_ns;           // under the soft limit, before the cycle
+        uint64_t synchronize_ns;     // requesting and awaiting handshakes
+        uint64_t mark_ns;
+        uint64_t sweep_ns;
+        uint64_t reclaim_ns;         // deleting RED objects, releasing pages
+        uint64_t cycle_ns;           // excluding the sleep
+    };
+    
+    // The last complete cycle; zero before the first ends
+    collector_statistics collector_stats();
+    // Summed over every cycle, except live, which is as of the last, and
+    // handshake_max_ns, which is a maximum
+    collector_statistics collector_stats_total();
+    
+    // Record each phase of each cycle, and each mutator's answer to each
+    // handshake request, in memory until dumped
+    void collector_trace(bool enabled);
+    // Write and discard the events recorded by the cycles ended so far, as
+    // a Chrome trace event JSON array; the collector is thread 0, and each
+    // mutator the number of its channel
+    void collector_trace_dump(FILE* file);
+    
     void mutator_enter();
     bool mutator_is_entered();
     
@@ -25,11 +94,22 @@ namespace aaa::gc {
     };
     
     void mutator_handshake();
+    // Leave the collector's reckoning, keeping the thread's mutator state
+    // for when it enters again
     void mutator_leave();
+    // Leave for good, freeing the thread's mutator state; for threads that
+    // are finishing
+    void mutator_exit();
     
     void* allocate(std::size_t bytes);
     void deallocate(void* ptr, std::size_t bytes);
     
+    // Turn BLACK everything reachable from the objects in [first, last)
+    // that is WHITE, with marker_count threads sharing the work as they do
+    // in a collection; returns the number of objects scanned.  Only for
+    // exercising the marker on objects the collector is not working on
+    std::size_t trace(const Object* const* first, const Object* const* last, int marker_count);
+    
 } // namespace gc
 
 #endif /* gc_hpp */
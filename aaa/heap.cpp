@@ -0,0 +1,284 @@
+//
+//  heap.cpp
+//  aaa
+//
+//  Created by Antony Searle on 24/1/2025.
+//
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include "heap.hpp"
+
+namespace aaa::gc {
+    
+    namespace {
+        
+        // Retired pages of each size class are listed as full, when they
+        // had nothing left to allocate as of the last sweep, or partial.
+        // Draws, retirements and sweeps of the lists take the heap lock;
+        // the allocation fast path never does
+        
+        struct _heap_list_t {
+            _heap_page_t* head = nullptr;
+        };
+        
+        std::mutex _heap_mutex;
+        _heap_list_t _heap_full[HEAP_SIZE_CLASSES];
+        _heap_list_t _heap_partial[HEAP_SIZE_CLASSES];
+        _heap_page_t* _heap_reserve = nullptr;
+        Atomic<uint64_t> _heap_pages{0};
+        Atomic<uint64_t> _heap_reserve_pages{0};
+        Atomic<uint64_t> _heap_large_objects{0};
+        Atomic<uint64_t> _heap_pages_released{0};
+        
+        void _heap_list_push(_heap_list_t& list, _heap_page_t* p) {
+            p->prev = nullptr;
+            p->next = list.head;
+            if (list.head)
+                list.head->prev = p;
+            list.head = p;
+        }
+        
+        void _heap_list_erase(_heap_list_t& list, _heap_page_t* p) {
+            if (p->prev)
+                p->prev->next = p->next;
+            else
+                list.head = p->next;
+            if (p->next)
+                p->next->prev = p->prev;
+        }
+        
+        void* _heap_page_map(size_t bytes) {
+            void* p = aligned_alloc(HEAP_PAGE_SIZE, bytes);
+            if (!p) {
+                fprintf(stderr, "gc heap exhausted\n");
+                abort();
+            }
+            return p;
+        }
+        
+        void _heap_page_format(_heap_page_t* p, size_t k, size_t block_size, size_t capacity) {
+            p->local_free = nullptr;
+            p->bump = p->data;
+            p->end = p->data + capacity * block_size;
+            p->allocated = 0;
+            p->size_class = k;
+            p->block_size = block_size;
+            p->slot_reciprocal = (k < HEAP_SIZE_CLASSES) ? (((uint64_t)1 << 32) + block_size - 1) / block_size : 0;
+            p->next = nullptr;
+            p->prev = nullptr;
+            p->log = (uint16_t*)(((uintptr_t)p->end + 7) & ~(uintptr_t)7);
+            p->log_capacity = (uint32_t)capacity;
+            p->log_first = 0;
+            p->log_pending = 0;
+            p->owner.store(nullptr, Ordering::RELAXED);
+            p->thread_free.store(nullptr, Ordering::RELAXED);
+            p->freed.store(0, Ordering::RELAXED);
+        }
+        
+        bool _heap_page_is_empty(_heap_page_t* p) {
+            return p->allocated == p->freed.load(Ordering::ACQUIRE);
+        }
+        
+        bool _heap_page_has_room(_heap_page_t* p) {
+            return (p->local_free
+                    || (p->bump != p->end)
+                    || p->thread_free.load(Ordering::RELAXED));
+        }
+        
+        // Requires the heap lock
+        _heap_page_t* _heap_page_acquire(size_t k) {
+            _heap_page_t* p = _heap_partial[k].head;
+            if (p) {
+                _heap_list_erase(_heap_partial[k], p);
+                return p;
+            }
+            p = _heap_reserve;
+            if (p) {
+                _heap_reserve = p->next;
+                _heap_reserve_pages.sub_fetch(1, Ordering::RELAXED);
+            } else {
+                p = (_heap_page_t*)_heap_page_map(HEAP_PAGE_SIZE);
+            }
+            size_t block_size = (k + 1) * HEAP_GRANULE;
+            _heap_page_format(p, k, block_size, (HEAP_PAGE_SIZE - sizeof(_heap_page_t)) / (block_size + sizeof(uint16_t)));
+            _heap_pages.add_fetch(1, Ordering::RELAXED);
+            return p;
+        }
+        
+        // The entries logged by this thread on pages it has since retired
+        thread_local std::vector<heap_extent> _tl_heap_log_retired;
+        
+        // Requires the heap lock
+        void _heap_page_retire(_heap_page_t* p) {
+            if (p->log_pending)
+                _tl_heap_log_retired.push_back(_heap_log_take(p));
+            p->owner.store(nullptr, Ordering::RELAXED);
+            _heap_list_push(_heap_page_has_room(p)
+                            ? _heap_partial[p->size_class]
+                            : _heap_full[p->size_class], p);
+        }
+        
+        void* _heap_allocate_large(size_t n) {
+            // with room for the log's single entry
+            size_t bytes = (sizeof(_heap_page_t) + n + 16 + HEAP_PAGE_SIZE - 1) & -HEAP_PAGE_SIZE;
+            _heap_page_t* p = (_heap_page_t*)_heap_page_map(bytes);
+            _heap_page_format(p, HEAP_SIZE_CLASSES, n, 1);
+            p->bump = p->end;
+            p->allocated = 1;
+            _heap_large_objects.add_fetch(1, Ordering::RELAXED);
+            return std::memset(p->data, 0, n);
+        }
+        
+        // Retires a thread's cached pages when it exits
+        struct _heap_thread_exit_t {
+            bool armed = false;
+            ~_heap_thread_exit_t() {
+                if (armed)
+                    heap_flush();
+            }
+        };
+        
+        thread_local _heap_thread_exit_t _tl_heap_thread_exit;
+        
+    } // namespace
+    
+    void* _heap_allocate_cold(size_t n) {
+        size_t k = _heap_size_class(n);
+        if (k >= HEAP_SIZE_CLASSES)
+            return _heap_allocate_large(n);
+        _heap_page_t*& p = _tl_heap_pages[k];
+        if (p) {
+            // Take back the blocks freed by other threads before giving up
+            // the page
+            _heap_free_t* q = p->thread_free.exchange(nullptr, Ordering::ACQUIRE);
+            if (q) {
+                p->local_free = q;
+                return heap_allocate(n);
+            }
+        }
+        {
+            std::unique_lock lock{_heap_mutex};
+            if (p)
+                _heap_page_retire(p);
+            p = _heap_page_acquire(k);
+            p->owner.store(_tl_heap_pages, Ordering::RELAXED);
+        }
+        // Constructed before the exit hook, so destroyed after the hook has
+        // retired our pages into it
+        (void) _heap_log_retired();
+        _tl_heap_thread_exit.armed = true;
+        if (!p->local_free)
+            p->local_free = p->thread_free.exchange(nullptr, Ordering::ACQUIRE);
+        return heap_allocate(n);
+    }
+    
+    void _heap_log_large(_heap_page_t* p) {
+        p->log[0] = (uint16_t)((p->data - (unsigned char*)p) >> 3);
+        _tl_heap_log_retired.push_back(heap_extent{p, 0, 1});
+    }
+    
+    std::vector<heap_extent>& _heap_log_retired() {
+        return _tl_heap_log_retired;
+    }
+    
+    void heap_deallocate(void* q) {
+        if (!q)
+            return;
+        _heap_page_t* p = _heap_page_of(q);
+        if (p->size_class == HEAP_SIZE_CLASSES) {
+            _heap_large_objects.sub_fetch(1, Ordering::RELAXED);
+            free(p);
+            return;
+        }
+        _heap_free_t* r = (_heap_free_t*)q;
+        if (p->owner.load(Ordering::RELAXED) == _tl_heap_pages) {
+            r->next = p->local_free;
+            p->local_free = r;
+            --p->allocated;
+            return;
+        }
+        r->next = p->thread_free.load(Ordering::RELAXED);
+        while (!p->thread_free.compare_exchange_weak(r->next,
+                                                     r,
+                                                     Ordering::RELEASE,
+                                                     Ordering::RELAXED))
+            ;
+        // Counted after the push, so that a sweep that sees the page empty
+        // sees every block back
+        p->freed.add_fetch(1, Ordering::RELEASE);
+    }
+    
+    void heap_flush() {
+        std::unique_lock lock{_heap_mutex};
+        for (_heap_page_t*& p : _tl_heap_pages)
+            if (p)
+                _heap_page_retire(std::exchange(p, nullptr));
+    }
+    
+    void heap_sweep_pages() {
+        _heap_page_t* released = nullptr;
+        {
+            std::unique_lock lock{_heap_mutex};
+            for (size_t k = 0; k != HEAP_SIZE_CLASSES; ++k) {
+                for (_heap_list_t* list : { _heap_full + k, _heap_partial + k }) {
+                    _heap_page_t* p = list->head;
+                    while (p) {
+                        _heap_page_t* next = p->next;
+                        if (_heap_page_is_empty(p)) {
+                            _heap_list_erase(*list, p);
+                            p->next = released;
+                            released = p;
+                        } else if ((list == _heap_full + k) && _heap_page_has_room(p)) {
+                            _heap_list_erase(*list, p);
+                            _heap_list_push(_heap_partial[k], p);
+                        }
+                        p = next;
+                    }
+                }
+            }
+            while (released && (_heap_reserve_pages.load(Ordering::RELAXED) < HEAP_RESERVE_PAGES)) {
+                _heap_page_t* p = released;
+                released = p->next;
+                p->next = _heap_reserve;
+                _heap_reserve = p;
+                _heap_reserve_pages.add_fetch(1, Ordering::RELAXED);
+                _heap_pages.sub_fetch(1, Ordering::RELAXED);
+                _heap_pages_released.add_fetch(1, Ordering::RELAXED);
+            }
+        }
+        while (released) {
+            _heap_page_t* p = released;
+            released = p->next;
+            free(p);
+            _heap_pages.sub_fetch(1, Ordering::RELAXED);
+            _heap_pages_released.add_fetch(1, Ordering::RELAXED);
+        }
+    }
+    
+    void heap_trim() {
+        _heap_page_t* reserve = nullptr;
+        {
+            std::unique_lock lock{_heap_mutex};
+            reserve = std::exchange(_heap_reserve, nullptr);
+            _heap_reserve_pages.store(0, Ordering::RELAXED);
+        }
+        while (reserve)
+            free(std::exchange(reserve, reserve->next));
+    }
+    
+    heap_statistics heap_stats() {
+        return heap_statistics{
+            .pages = _heap_pages.load(Ordering::RELAXED),
+            .reserve_pages = _heap_reserve_pages.load(Ordering::RELAXED),
+            .large_objects = _heap_large_objects.load(Ordering::RELAXED),
+            .pages_released = _heap_pages_released.load(Ordering::RELAXED),
+        };
+    }
+    
+} // namespace aaa::gc
@@ -0,0 +1,247 @@
+//
+//  heap.hpp
+//  aaa
+//
+//  Created by Antony Searle on 24/1/2025.
+//
+
+#ifndef heap_hpp
+#define heap_hpp
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include <bit>
+#include <utility>
+#include <vector>
+
+#include "atomic.hpp"
+
+// Keep the colors of gc::Objects in a side table on each heap page, rather
+// than in each object; configured by the CMake option of the same name
+#ifndef AAA_GC_SIDE_TABLE_COLORS
+#define AAA_GC_SIDE_TABLE_COLORS 0
+#endif
+
+namespace aaa::gc {
+    
+    // Size-segregated heap for gc::Objects
+    //
+    // Objects are carved from pages aligned to their size, so the header of
+    // the page holding any object is found by masking its address.  Each
+    // page serves a single size class, in granules of 8 bytes up to 1 KiB;
+    // a larger object gets a page of its own.
+    //
+    // Each thread caches a page per size class and allocates from it without
+    // synchronization: first the blocks it freed itself, then untouched
+    // slots, then the blocks other threads (the collector) freed into it.
+    // An exhausted page is retired to the heap, and the thread draws a page
+    // with free blocks, or an empty one, in its place.
+    //
+    // Each page counts the blocks it has handed out and the blocks freed
+    // back to it.  After a sweep, the collector walks the retired pages,
+    // releases those whose counts agree in bulk, without touching their
+    // blocks, and makes those with free blocks available to allocate from.
+    //
+    // Each page also logs the gc::Objects allocated from it, as the offsets
+    // of their blocks in a ring that follows the slots, for the allocating
+    // thread to hand to the collector a page at a time as extents of the
+    // ring.  The collector reads an extent before it can free any of its
+    // objects, and there are never more live blocks than slots, so the
+    // ring never overwrites an entry the collector has yet to read.
+    //
+    // With AAA_GC_SIDE_TABLE_COLORS, each page also holds the two-bit colors
+    // of its blocks, packed 32 to a word and indexed by slot, so that
+    // shading, tracing and sweeping read and write dense words instead of
+    // the header of every object.  Every gc::Object must then live in the
+    // heap.
+    
+    constexpr size_t HEAP_PAGE_SIZE = 1 << 16;
+    constexpr size_t HEAP_GRANULE = 8;
+    constexpr size_t HEAP_SIZE_CLASSES = 128;
+    constexpr size_t HEAP_COLOR_WORDS = (HEAP_PAGE_SIZE / HEAP_GRANULE * 2 + 63) / 64;
+    
+    struct _heap_free_t {
+        _heap_free_t* next;
+    };
+    
+    struct _heap_page_t {
+        
+        // Touched by the owning thread; by the collector, under the heap
+        // lock, once retired
+        _heap_free_t* local_free;    // blocks freed by the owner
+        unsigned char* bump;         // next untouched slot
+        unsigned char* end;          // past the last slot
+        size_t allocated;            // handed out, less freed by the owner
+        size_t size_class;           // HEAP_SIZE_CLASSES for a large page
+        size_t block_size;
+        uint64_t slot_reciprocal;    // 2^32 / block_size, rounded up
+        uint16_t* log;               // ring of block offsets, in eights
+        uint32_t log_capacity;
+        uint32_t log_first;          // first entry not yet handed over
+        uint32_t log_pending;        // entries not yet handed over
+        _heap_page_t* next;          // in the heap's lists, once retired
+        _heap_page_t* prev;
+        Atomic<_heap_page_t**> owner; // thread cache, or null once retired
+        
+        // Touched by other threads freeing blocks
+        alignas(CACHE_LINE_SIZE) Atomic<_heap_free_t*> thread_free;
+        Atomic<size_t> freed;
+        
+#if AAA_GC_SIDE_TABLE_COLORS
+        alignas(CACHE_LINE_SIZE) Atomic<uint64_t> colors[HEAP_COLOR_WORDS];
+#endif
+        
+        alignas(CACHE_LINE_SIZE) unsigned char data[0];
+        
+    };
+    
+    // Logged entries of a page, handed over by the thread that logged them
+    struct heap_extent {
+        _heap_page_t* page;
+        uint32_t first;
+        uint32_t count;
+    };
+    
+    inline thread_local _heap_page_t* _tl_heap_pages[HEAP_SIZE_CLASSES] = {};
+    inline thread_local uint64_t _tl_heap_log_dirty[HEAP_SIZE_CLASSES / 64] = {};
+    void* _heap_allocate_cold(size_t n);
+    void _heap_log_large(_heap_page_t* p);
+    std::vector<heap_extent>& _heap_log_retired();
+    
+    constexpr size_t _heap_size_class(size_t n) {
+        return n ? (n - 1) / HEAP_GRANULE : 0;
+    }
+    
+    inline _heap_page_t* _heap_page_of(const void* q) {
+        return (_heap_page_t*)((uintptr_t)q & -(uintptr_t)HEAP_PAGE_SIZE);
+    }
+    
+    // The slot of the block holding q, which may point anywhere within it;
+    // the reciprocal is exact for offsets within a page, and zero for a
+    // large page, whose only block is slot 0
+    inline size_t _heap_slot_of(const _heap_page_t* p, const void* q) {
+        return (((const unsigned char*)q - p->data) * p->slot_reciprocal) >> 32;
+    }
+    
+#if AAA_GC_SIDE_TABLE_COLORS
+    
+    // The word holding the color of the block holding q, and the shift of
+    // its two bits
+    inline Atomic<uint64_t>& _heap_color_word(const void* q, int& shift) {
+        _heap_page_t* p = _heap_page_of(q);
+        size_t slot = _heap_slot_of(p, q);
+        shift = (int)(slot & 31) << 1;
+        return p->colors[slot >> 5];
+    }
+    
+#endif
+    
+    // Zeroed, like calloc; aligned to the largest power of two dividing
+    // the size class, so any object of size n is suitably aligned
+    inline void* heap_allocate(size_t n) {
+        size_t k = _heap_size_class(n);
+        if (k < HEAP_SIZE_CLASSES) [[likely]] {
+            if (_heap_page_t* p = _tl_heap_pages[k]) [[likely]] {
+                void* q = p->local_free;
+                if (q) {
+                    p->local_free = p->local_free->next;
+                } else if (p->bump != p->end) {
+                    q = p->bump;
+                    p->bump += p->block_size;
+                } else {
+                    return _heap_allocate_cold(n);
+                }
+                ++p->allocated;
+                return std::memset(q, 0, n);
+            }
+        }
+        return _heap_allocate_cold(n);
+    }
+    
+    // Any thread may free any block
+    void heap_deallocate(void* q);
+    
+    // Log the block q, just allocated by the calling thread, as an object
+    // for the collector to find in the extents the thread hands over
+    inline void heap_log(const void* q) {
+        _heap_page_t* p = _heap_page_of(q);
+        size_t k = p->size_class;
+        if (k == HEAP_SIZE_CLASSES) [[unlikely]]
+            return _heap_log_large(p);
+        uint32_t i = p->log_first + p->log_pending;
+        if (i >= p->log_capacity)
+            i -= p->log_capacity;
+        p->log[i] = (uint16_t)(((const unsigned char*)q - (const unsigned char*)p) >> 3);
+        ++p->log_pending;
+        _tl_heap_log_dirty[k >> 6] |= (uint64_t)1 << (k & 63);
+    }
+    
+    // Take the pending entries of a page the calling thread owns
+    inline heap_extent _heap_log_take(_heap_page_t* p) {
+        heap_extent extent{p, p->log_first, p->log_pending};
+        p->log_first += p->log_pending;
+        if (p->log_first >= p->log_capacity)
+            p->log_first -= p->log_capacity;
+        p->log_pending = 0;
+        return extent;
+    }
+    
+    // Hand the extents the calling thread has logged since it last did so
+    // to sink, one per page touched
+    template<typename F>
+    void heap_publish_log(F&& sink) {
+        std::vector<heap_extent>& retired = _heap_log_retired();
+        for (const heap_extent& extent : retired)
+            sink(extent);
+        retired.clear();
+        for (size_t j = 0; j != HEAP_SIZE_CLASSES / 64; ++j) {
+            for (uint64_t bits = std::exchange(_tl_heap_log_dirty[j], 0); bits; bits &= bits - 1) {
+                _heap_page_t* p = _tl_heap_pages[j * 64 + std::countr_zero(bits)];
+                if (p && p->log_pending)
+                    sink(_heap_log_take(p));
+            }
+        }
+    }
+    
+    // Call f with each block of an extent that another thread handed over
+    template<typename F>
+    void heap_extent_for_each(const heap_extent& extent, F&& f) {
+        const _heap_page_t* p = extent.page;
+        uint32_t i = extent.first;
+        for (uint32_t n = extent.count; n; --n) {
+            f((unsigned char*)p + ((size_t)p->log[i] << 3));
+            if (++i == p->log_capacity)
+                i = 0;
+        }
+    }
+    
+    // Retire the calling thread's cached pages, so that the collector may
+    // reclaim them; done for each thread as it exits
+    void heap_flush();
+    
+    // Release the retired pages that hold no live blocks and offer the rest
+    // for reuse; called by the collector after a sweep
+    void heap_sweep_pages();
+    
+    // Pages kept for reuse when released, rather than freed
+    constexpr size_t HEAP_RESERVE_PAGES = 16;
+    
+    // Free the reserve; done when the collector stops, so that an empty
+    // heap holds no memory
+    void heap_trim();
+    
+    struct heap_statistics {
+        uint64_t pages;          // small object pages in use
+        uint64_t reserve_pages;  // empty, kept for reuse
+        uint64_t large_objects;  // each on a page of its own
+        uint64_t pages_released; // by heap_sweep_pages, ever
+    };
+    
+    heap_statistics heap_stats();
+    
+} // namespace aaa::gc
+
+#endif /* heap_hpp */
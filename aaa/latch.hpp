@@ -158,11 +158,11 @@ namespace aaa {
             struct promise_type {
                 
                 static void* operator new(std::size_t count) {
-                    return arena_allocate(count);
+                    return arena_allocate_recyclable(count);
                 }
                 
-                static void operator delete(void*) {
-                    // no-op
+                static void operator delete(void* ptr, std::size_t count) {
+                    arena_recycle(ptr, count);
                 }
                 
                 
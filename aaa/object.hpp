@@ -11,6 +11,7 @@
 
 
 #include "atomic.hpp"
+#include "heap.hpp"
 // #include "concepts.hpp"
 // #include "typeinfo.hpp"
 // #include "type_traits.hpp"
@@ -40,9 +41,14 @@ namespace aaa::gc {
         RED   = 3,
     };
     
+    // Stored in the object, or with AAA_GC_SIDE_TABLE_COLORS in the side
+    // table of its heap page, found from the address of this member
+    
     struct AtomicEncodedColor {
         
+#if !AAA_GC_SIDE_TABLE_COLORS
         Atomic<std::underlying_type_t<Color>> _encoded;
+#endif
         
         AtomicEncodedColor();
         Color load() const;
@@ -63,7 +69,7 @@ namespace aaa::gc {
         static void operator delete[](void*) = delete;
         
         // TODO: is it useful to have a base class above tricolored + sweep?
-        mutable AtomicEncodedColor color;
+        [[no_unique_address]] mutable AtomicEncodedColor color;
         
         Object();
         Object(const Object&);
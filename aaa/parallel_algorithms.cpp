@@ -0,0 +1,8 @@
+//
+//  parallel_algorithms.cpp
+//  aaa
+//
+//  Created by Antony Searle on 22/1/2025.
+//
+
+#include "parallel_algorithms.hpp"
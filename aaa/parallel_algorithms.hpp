@@ -0,0 +1,662 @@
+//
+//  parallel_algorithms.hpp
+//  aaa
+//
+//  Created by Antony Searle on 22/1/2025.
+//
+
+#ifndef parallel_algorithms_hpp
+#define parallel_algorithms_hpp
+
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+
+#include <algorithm>
+
+#include "execution_policy.hpp"
+#include "fork.hpp"
+#include "latch.hpp"
+#include "persistent_map.hpp"
+#include "skiplist.hpp"
+
+namespace aaa {
+    
+    // basic/slow/simple/serial skiplist to trie
+    template<typename T>
+    PersistentIntMap<T> sync_persist_skiplist(typename frozen_skiplist_map<uint64_t, T>::cursor a,
+                          uint64_t key_low,
+                          uint64_t key_high) {
+        PersistentIntMap<T> c;
+        auto aa = a.as_iterator();
+        assert(aa);
+        for (;; ++aa) {
+            if (!aa)
+                break;
+            const std::pair<uint64_t, T>& kv = *aa;
+            if (kv.first > key_high)
+                break;
+            if (kv.first < key_low)
+                continue;
+            printf("emplacing %llx:%llx\n", kv.first, kv.second);
+            c.insert_or_replace(kv.first, kv.second);
+        }
+        return c;
+    }
+    
+    
+    // serial skiplist to trie, with the same structure as
+    // async_persist_skiplist, for subtrees below the grain size
+    template<typename T>
+    const typename PersistentIntMap<T>::Node*
+    persist_skiplist(typename frozen_skiplist_map<uint64_t, T>::cursor a,
+                     uint64_t outer_key_low,
+                     uint64_t outer_key_high) {
+        
+        using U = PersistentIntMap<T>::Node;
+        
+        assert(outer_key_low <= outer_key_high);
+        
+        uint64_t delta = outer_key_low ^ outer_key_high;
+        assert(delta);
+        int new_shift = ((63 - __builtin_clzll(delta)) / 6) * 6;
+        uint64_t new_prefix = outer_key_low & (~(uint64_t)63 << new_shift);
+        uint64_t imax = ((uint64_t)63 << new_shift >> new_shift) + 1;
+        
+        if (new_shift) {
+            const U* results[64] = {};
+            for (uint64_t i = 0; i != imax; ++i) {
+                uint64_t key_low = new_prefix | (i << new_shift);
+                uint64_t key_high = new_prefix | ~(~i << new_shift);
+                auto c = a;
+                if (c.refine_closed_range(key_low, key_high))
+                    results[i] = persist_skiplist<T>(c, key_low, key_high);
+            }
+            return U::make_from_nullable_array(new_prefix, new_shift, results);
+        } else {
+            T results[64] = {};
+            uint64_t new_bitmap = 0;
+            for (uint64_t i = 0; i != imax; ++i) {
+                uint64_t key = new_prefix | i;
+                auto b = a.find(key);
+                if (b) {
+                    results[i] = b->second;
+                    new_bitmap |= (uint64_t)1 << i;
+                }
+            }
+            return U::make_from_array(new_prefix, new_bitmap, results);
+        }
+    }
+    
+    // async/parallel skiplist to trie
+    template<typename T>
+    latch::signalling_coroutine
+    async_persist_skiplist(latch&, // <-- signalled by coroutine promise
+                     typename frozen_skiplist_map<uint64_t, T>::cursor a,
+                     const typename PersistentIntMap<T>::Node** target,
+                     uint64_t outer_key_low,
+                     uint64_t outer_key_high,
+                     execution_policy policy = {}) {
+        
+        using U = PersistentIntMap<T>::Node;
+        
+        assert(target);
+        assert(outer_key_low <= outer_key_high);
+
+        // find the common prefix
+        uint64_t delta = outer_key_low ^ outer_key_high;
+        assert(delta);
+        int new_shift = ((63 - __builtin_clzll(delta)) / 6) * 6;
+        uint64_t new_prefix = outer_key_low & (~(uint64_t)63 << new_shift);
+        assert(!((outer_key_low ^ new_prefix) >> new_shift >> 6));
+        assert(!((outer_key_high ^ new_prefix) >> new_shift >> 6));
+                
+        // handle the situation where the chunks don't neatly divide the word
+        uint64_t imax = ((uint64_t)63 << new_shift >> new_shift) + 1;
+                
+        if (new_shift && (new_shift <= policy.serial_shift)) {
+            // below the grain size
+            *target = persist_skiplist<T>(a, outer_key_low, outer_key_high);
+        } else if (new_shift) {
+            const U* results[64] = {};
+            latch inner;
+            for (uint64_t i = 0; i != imax; ++i) {
+                uint64_t key_low = new_prefix | (i << new_shift);
+                uint64_t key_high = new_prefix | ~(~i << new_shift);
+                assert(key_low <= key_high);
+                assert(key_low >= outer_key_low);
+                assert(key_high <= outer_key_high);
+                auto c = a;
+                bool in_b = c.refine_closed_range(key_low, key_high);
+                if (in_b)
+                    async_persist_skiplist<T>(inner, c, results + i, key_low, key_high, policy);
+            }
+            co_await inner;
+            *target = U::make_from_nullable_array(new_prefix, new_shift, results);
+        } else {
+            assert(new_shift == 0);
+            T results[64] = {};
+            uint64_t new_bitmap = 0;
+            for (uint64_t i = 0; i != imax; ++i) {
+                uint64_t key = new_prefix | i;
+                assert(key >= outer_key_low);
+                assert(key <= outer_key_high);
+                auto b = a.find(key);
+                if (b) {
+                    assert(b->first == key);
+                    results[i] = b->second;
+                    new_bitmap |= (uint64_t)1 << i;
+                }
+            }
+            *target = U::make_from_array(new_prefix, new_bitmap, results);
+        }
+    }
+    
+    
+    
+    
+    
+    // serial merge_right, with the same structure as parallel_merge_right,
+    // for subtrees below the grain size
+    template<typename T>
+    const typename PersistentIntMap<T>::Node*
+    merge_right(const typename PersistentIntMap<T>::Node* a,
+                typename frozen_skiplist_map<uint64_t, T>::cursor b, // <-- points before the key range
+                uint64_t outer_key_low, // <-- inclusive range of keys to handle
+                uint64_t outer_key_high) {
+        using U = PersistentIntMap<T>::Node;
+        
+        if (!b.refine_closed_range(outer_key_low, outer_key_high))
+            return a;
+        if (!a)
+            return persist_skiplist<T>(b, outer_key_low, outer_key_high);
+        
+        uint64_t a_low = a->_prefix;
+        uint64_t a_high = a->_prefix + ~(~(uint64_t)63 << a->_shift);
+        assert(outer_key_low <= a_low);
+        assert(outer_key_high >= a_high);
+        
+        if ((outer_key_low < a_low) || (outer_key_high > a_high)) {
+            uint64_t delta = outer_key_low ^ outer_key_high;
+            assert(delta);
+            int new_shift = ((63 - __builtin_clzll(delta)) / 6) * 6;
+            assert(new_shift > a->_shift);
+            uint64_t new_prefix = outer_key_low & (~(uint64_t)63 << new_shift);
+            uint64_t ia = (a->_prefix >> new_shift) & 63;
+            uint64_t imax = ((uint64_t)63 << new_shift >> new_shift) + 1;
+            const U* results[64] = {};
+            for (uint64_t i = 0; i != imax; ++i) {
+                uint64_t key_low = new_prefix | (i << new_shift);
+                uint64_t key_high = new_prefix | ~(~i << new_shift);
+                bool in_a = (i == ia);
+                auto c = b;
+                bool in_b = c.refine_closed_range(key_low, key_high);
+                if (in_a && !in_b) {
+                    results[i] = a;
+                } else if (!in_a && in_b) {
+                    results[i] = persist_skiplist<T>(c, key_low, key_high);
+                } else if (in_a && in_b) {
+                    results[i] = merge_right<T>(a, c, key_low, key_high);
+                }
+            }
+            return U::make_from_nullable_array(new_prefix, new_shift, results);
+        } else if (a->_shift) {
+            uint64_t imax = ((uint64_t)63 << a->_shift >> a->_shift) + 1;
+            const U* results[64] = {};
+            uint64_t k = 0;
+            for (uint64_t i = 0; i != imax; ++i) {
+                uint64_t j = (uint64_t)1 << i;
+                uint64_t key_low = a->_prefix | (i << a->_shift);
+                uint64_t key_high = a->_prefix | ~(~i << a->_shift);
+                bool in_a = j & a->_bitmap;
+                auto c = b;
+                bool in_b = c.refine_closed_range(key_low, key_high);
+                if (in_a && !in_b) {
+                    results[i] = a->_children[k++];
+                } else if (!in_a && in_b) {
+                    results[i] = persist_skiplist<T>(c, key_low, key_high);
+                } else if (in_a && in_b) {
+                    results[i] = merge_right<T>(a->_children[k++], c, key_low, key_high);
+                }
+            }
+            return U::make_from_nullable_array(a->_prefix, a->_shift, results);
+        } else {
+            uint64_t new_bitmap = 0;
+            T results[64] = {};
+            uint64_t k = 0;
+            for (uint64_t i = 0; i != 64; ++i) {
+                uint64_t j = (uint64_t)1 << i;
+                uint64_t key = a->_prefix | i;
+                auto p = b.lower_bound(key);
+                if (j & a->_bitmap) {
+                    results[i] = a->_values[k++];
+                    new_bitmap |= j;
+                }
+                if (p && (p->first == key)) {
+                    results[i] = p->second;
+                    new_bitmap |= j;
+                }
+            }
+            return U::make_from_array(a->_prefix, new_bitmap, results);
+        }
+    }
+    
+    template<typename T>
+    latch::signalling_coroutine
+    parallel_merge_right(latch&, // <-- signalled by coroutine promise
+                        const typename PersistentIntMap<T>::Node* a,
+                        typename frozen_skiplist_map<uint64_t, T>::cursor b, // <-- points before the key range
+                        const typename PersistentIntMap<T>::Node** target,
+                        uint64_t outer_key_low, // <-- inclusive range of keys to handle
+                        uint64_t outer_key_high,
+                        execution_policy policy = {}
+                        ) {
+        using U = PersistentIntMap<T>::Node;
+        using C = frozen_skiplist_map<uint64_t, T>::cursor;
+        
+    TAIL:
+        //printf("keyrange: [%llx, %llx]\n", outer_key_low, outer_key_high);
+        
+        {
+            auto p = (*b._next)[0];
+            auto q = (*b._next)[b._level];
+          //  printf("b-cursor points to %llx, %llx\n", p->_key.first, q->_key.second);
+        }
+
+
+        {
+            // process the skiplist cursor to match the desired range
+            // TODO: this is probably already guaranteed by the caller
+            bool nonempty = b.refine_closed_range(outer_key_low, outer_key_high);
+            if (!nonempty) {
+               // printf("skiplist empty over [%llx, %llx]\n", outer_key_low, outer_key_high);
+                // nothing in the skiplist, reuse the trie
+                *target = a;
+                co_return;
+            }
+        }
+        
+        if (!a) {
+            // TODO: this is probably already guaranteed by the caller
+            // nothing in the trie, process the skiplist
+            // TODO: this should be a parallel job
+            //printf("PersistentIntMap empty over  [%llx, %llx]\n", outer_key_low, outer_key_high);
+            // *target = persistent_int_map_from_frozen_skiplist_map_cursor_range<T>(b, outer_key_low, outer_key_high)._root;
+            latch inner;
+            async_persist_skiplist<T>(inner, b, target, outer_key_low, outer_key_high, policy);
+            co_await inner;
+            co_return;
+        }
+        
+        // the skiplist and the trie both have some elements in the keyrange
+        
+        int range_shift = ((63 - __builtin_clzll(outer_key_low ^ outer_key_high)) / 6) * 6;
+        if (range_shift <= policy.serial_shift) {
+            // below the grain size
+            *target = merge_right<T>(a, b, outer_key_low, outer_key_high);
+            co_return;
+        }
+        
+        // TODO: handle the case that the keyrange does not match the range
+        // implied by the prefix of a
+        
+        assert(a);
+        //printf("prefix  :  %llx\n", a->_prefix);
+        //printf("prefix^ :  %llx\n", a->_prefix + ~(~(uint64_t)63 << a->_shift));
+
+        uint64_t a_low = a->_prefix;
+        uint64_t a_high = a->_prefix + ~(~(uint64_t)63 << a->_shift);
+        assert(outer_key_low <= a_low);
+        assert(outer_key_high >= a_high);
+
+        if ((outer_key_low < a_low) || (outer_key_high > a_high)) {
+            
+            // printf("sinister considers    %llx-%llx\n", outer_key_low, outer_key_high);
+
+            // TODO: most of this code is shared with the shift != 0 path
+                        
+            uint64_t delta = outer_key_low ^ outer_key_high;
+            assert(delta);
+            int new_shift = ((63 - __builtin_clzll(delta)) / 6) * 6;
+            assert(new_shift > a->_shift);
+            uint64_t new_prefix = outer_key_low & (~(uint64_t)63 << new_shift);
+            assert(!((outer_key_low ^ new_prefix) >> new_shift >> 6));
+            assert(!((outer_key_high ^ new_prefix) >> new_shift >> 6));
+            assert(!((a->_prefix ^ new_prefix) >> new_shift >> 6));
+
+            uint64_t ia = (a->_prefix >> new_shift) & 63;
+            
+            uint64_t imax = ((uint64_t)63 << new_shift >> new_shift) + 1;
+            
+            latch inner;
+            const U* results[64] = {};
+                                    
+            // the merge with a is deferred until we know if it is our only
+            // subproblem
+            bool alone = true;
+            bool merge = false;
+            C merge_cursor = b;
+            uint64_t merge_key_low = 0;
+            uint64_t merge_key_high = 0;
+            
+            //printf("before loop\n");
+            
+            for (uint64_t i = 0; i != imax; ++i) {
+                                
+                uint64_t key_low = new_prefix | (i << new_shift);
+                uint64_t key_high = new_prefix | ~(~i << new_shift);
+                
+               //  printf("sinister iterate      %llx-%llx with %llu\n", key_low, key_high, i);
+
+
+                bool in_a = (i == ia);
+                
+                auto c = b;
+                bool in_b = c.refine_closed_range(key_low, key_high);
+
+                if (in_a && !in_b) {
+                    //printf("sinister persist  for %llx-%llx\n", key_low, key_high);
+                    results[i] = a;
+                    alone = false;
+                } else if (!in_a && in_b) {
+                    //printf("sinister skiplist for %llx-%llx\n", key_low, key_high);
+                    // results[i] = persistent_int_map_from_frozen_skiplist_map_cursor_range<T>(c, key_low, key_high)._root;
+                    async_persist_skiplist<T>(inner, c, results + i, key_low, key_high, policy);
+                    alone = false;
+                } else if (in_a && in_b) {
+                    //printf("sinister common   for %llx-%llx\n", key_low, key_high);
+                    merge = true;
+                    merge_cursor = c;
+                    merge_key_low = key_low;
+                    merge_key_high = key_high;
+                } else {
+                    assert(!in_a && !in_b);
+                    // printf("sinister nothing  for %llx-%llx\n", key_low, key_high);
+                }
+
+            }
+            
+            if (merge) {
+                if (alone && policy.inline_single) {
+                    // the merge would be the only entry in results, which
+                    // make_from_nullable_array returns as is, so we narrow
+                    // the range and carry on as the child
+                    b = merge_cursor;
+                    outer_key_low = merge_key_low;
+                    outer_key_high = merge_key_high;
+                    goto TAIL;
+                }
+                parallel_merge_right<T>(inner, a, merge_cursor, results + ia, merge_key_low, merge_key_high, policy);
+            }
+            
+            co_await inner;
+            *target = U::make_from_nullable_array(new_prefix, new_shift, results);
+
+        } else if (a->_shift) {
+            // not at bottom
+            uint64_t imax = ((uint64_t)63 << a->_shift >> a->_shift) + 1;
+
+            latch inner;
+            const U* results[64] = {};
+            uint64_t k = 0;
+            for (uint64_t i = 0; i != imax; ++i) {
+                uint64_t j = (uint64_t)1 << i;
+                uint64_t key_low = a->_prefix | (i << a->_shift);
+                uint64_t key_high = a->_prefix | ~(~i << a->_shift);
+                //printf("%llx-%llx under consideration\n", key_low, key_high);
+
+                bool in_a = j & a->_bitmap;
+                auto it_b = b.as_iterator();
+                //if (it_b)
+                  //  printf("it_b has key %llx\n", it_b->first);
+                
+                auto c = b;
+                bool in_b = c.refine_closed_range(key_low, key_high);
+                auto it_c = c.as_iterator();
+                //if (it_c)
+                  //  printf("it_c has key %llx\n", it_c->first);
+                if (in_a && !in_b) {
+                    //printf("%llx-%llx from pim\n", key_low, key_high);
+                    results[i] = a->_children[k++];
+                } else if (!in_a && in_b) {
+                    //printf("%llx-%llx from fsm\n", key_low, key_high);
+                    // results[i] = persistent_int_map_from_frozen_skiplist_map_cursor_range<T>(c, key_low, key_high)._root;
+                    async_persist_skiplist<T>(inner, c, results + i, key_low, key_high, policy);
+
+                } else if (in_a && in_b) {
+                    //printf("%llx-%llx from merge_right\n", key_low, key_high);
+                    parallel_merge_right<T>(inner, a->_children[k++], c, results + i, key_low, key_high, policy);
+                }
+            }
+
+            
+            co_await inner;
+            *target = U::make_from_nullable_array(a->_prefix, a->_shift, results);
+
+        } else {
+            assert(a->_shift == 0);
+            uint64_t new_bitmap = 0;
+            T results[64] = {};
+            uint64_t k = 0;
+            for (uint64_t i = 0; i != 64; ++i) {
+                uint64_t j = (uint64_t)1 << i;
+                uint64_t key = a->_prefix | i;
+                bool in_a = j & a->_bitmap;
+                // TODO: clumsy
+                auto p = b.lower_bound(key);
+                bool in_b = p && (p->first == key);
+                if (in_a) {
+                    results[i] = a->_values[k++];
+                    new_bitmap |= j;
+                }
+                if (in_b) {
+                    results[i] = p->second;
+                    new_bitmap |= j;
+                }
+            }
+            
+            *target = U::make_from_array(a->_prefix, new_bitmap, results);
+        }
+    }
+    
+    template<typename T>
+    latch::signalling_coroutine
+    parallel_merge_right(latch&,
+                         PersistentIntMap<T> a,
+                         frozen_skiplist_map<uint64_t, T> b,
+                         PersistentIntMap<T>& c,
+                         execution_policy policy = {}) {
+        latch inner;
+        parallel_merge_right<T>(inner,
+                                a._root,
+                                b.top(),
+                                &c._root,
+                                (uint64_t)0,
+                                ~(uint64_t)0,
+                                policy);
+        co_await inner;
+    }
+    
+    
+    
+    // serial parallel_persist_generate, for subtrees below the grain size
+    template<typename T, typename F>
+    const typename PersistentIntMap<T>::Node* persist_generate(uint64_t outer_key_low,
+                                                               uint64_t outer_key_high,
+                                                               const F& f) {
+        using U = PersistentIntMap<T>::Node;
+        
+        assert(outer_key_low <= outer_key_high);
+        
+        uint64_t delta = outer_key_low ^ outer_key_high;
+        assert(delta);
+        int new_shift = ((63 - __builtin_clzll(delta)) / 6) * 6;
+        uint64_t new_prefix = outer_key_low & (~(uint64_t)63 << new_shift);
+        uint64_t imax = ((uint64_t)63 << new_shift >> new_shift) + 1;
+        
+        if (new_shift) {
+            const U* results[64] = {};
+            for (uint64_t i = 0; i != imax; ++i) {
+                uint64_t key_low = new_prefix | (i << new_shift);
+                uint64_t key_high = new_prefix | ~(~i << new_shift);
+                if (key_low > outer_key_high)
+                    continue;
+                if (key_high < outer_key_low)
+                    continue;
+                results[i] = persist_generate<T, F>(std::max(key_low, outer_key_low),
+                                                    std::min(key_high, outer_key_high),
+                                                    f);
+            }
+            return U::make_from_nullable_array(new_prefix, new_shift, results);
+        } else {
+            T results[64] = {};
+            uint64_t new_bitmap = 0;
+            for (uint64_t i = 0; i != imax; ++i) {
+                uint64_t key = new_prefix | i;
+                results[i] = f(key);
+                new_bitmap |= (uint64_t)1 << i;
+            }
+            return U::make_from_array(new_prefix, new_bitmap, results);
+        }
+    }
+    
+    template<typename T, typename F>
+    latch::signalling_coroutine parallel_persist_generate(latch& outer,
+                                                          const typename PersistentIntMap<T>::Node** target,
+                                                          uint64_t outer_key_low,
+                                                          uint64_t outer_key_high,
+                                                          const F& f,
+                                                          execution_policy policy = {})
+                                                          
+    {
+        using U = PersistentIntMap<T>::Node;
+        
+        assert(target);
+        assert(outer_key_low <= outer_key_high);
+        
+        // find the common prefix
+        uint64_t delta = outer_key_low ^ outer_key_high;
+        assert(delta);
+        int new_shift = ((63 - __builtin_clzll(delta)) / 6) * 6;
+        uint64_t new_prefix = outer_key_low & (~(uint64_t)63 << new_shift);
+        assert(!((outer_key_low ^ new_prefix) >> new_shift >> 6));
+        assert(!((outer_key_high ^ new_prefix) >> new_shift >> 6));
+        
+        // handle the situation where the chunks don't neatly divide the word
+        uint64_t imax = ((uint64_t)63 << new_shift >> new_shift) + 1;
+        
+        latch inner;
+        
+        if (new_shift && (new_shift <= policy.serial_shift)) {
+            // below the grain size
+            *target = persist_generate<T, F>(outer_key_low, outer_key_high, f);
+            co_return;
+        } else if (new_shift) {
+            const U* results[64] = {};
+            for (uint64_t i = 0; i != imax; ++i) {
+                
+                uint64_t key_low = new_prefix | (i << new_shift);
+                uint64_t key_high = new_prefix | ~(~i << new_shift);
+                
+                assert(key_low <= key_high);
+                // assert(key_low >= outer_key_low);
+                if (key_low > outer_key_high)
+                    continue;
+                // assert(key_high <= outer_key_high);
+                if (key_high < outer_key_low)
+                    continue;
+                parallel_persist_generate<T, F>(inner, results + i,
+                                                std::max(key_low, outer_key_low),
+                                                std::min(key_high, outer_key_high), f, policy);
+            }
+            
+            co_await inner;
+            *target = U::make_from_nullable_array(new_prefix, new_shift, results);
+            co_return;
+
+        } else {
+            assert(new_shift == 0);
+            T results[64] = {};
+            uint64_t new_bitmap = 0;
+            for (uint64_t i = 0; i != imax; ++i) {
+                uint64_t key = new_prefix | i;
+                assert(key >= outer_key_low);
+                assert(key <= outer_key_high);
+                results[i] = f(key);
+                new_bitmap |= (uint64_t)1 << i;
+            }
+            *target = U::make_from_array(new_prefix, new_bitmap, results);
+            co_return;
+        }
+        
+        
+    }
+    
+    
+    // parallel_persist_generate as continuation-stealing fork/join
+    template<typename T, typename F>
+    fork_task fork_persist_generate(const typename PersistentIntMap<T>::Node** target,
+                                    uint64_t outer_key_low,
+                                    uint64_t outer_key_high,
+                                    const F& f) {
+        using U = PersistentIntMap<T>::Node;
+        
+        assert(target);
+        assert(outer_key_low <= outer_key_high);
+        
+        uint64_t delta = outer_key_low ^ outer_key_high;
+        assert(delta);
+        int new_shift = ((63 - __builtin_clzll(delta)) / 6) * 6;
+        uint64_t new_prefix = outer_key_low & (~(uint64_t)63 << new_shift);
+        uint64_t imax = ((uint64_t)63 << new_shift >> new_shift) + 1;
+        
+        if (new_shift) {
+            const U* results[64] = {};
+            for (uint64_t i = 0; i != imax; ++i) {
+                uint64_t key_low = new_prefix | (i << new_shift);
+                uint64_t key_high = new_prefix | ~(~i << new_shift);
+                if (key_low > outer_key_high)
+                    continue;
+                if (key_high < outer_key_low)
+                    continue;
+                co_await co_fork{fork_persist_generate<T, F>(results + i,
+                                                             std::max(key_low, outer_key_low),
+                                                             std::min(key_high, outer_key_high),
+                                                             f)};
+            }
+            co_await co_join{};
+            *target = U::make_from_nullable_array(new_prefix, new_shift, results);
+        } else {
+            T results[64] = {};
+            uint64_t new_bitmap = 0;
+            for (uint64_t i = 0; i != imax; ++i) {
+                uint64_t key = new_prefix | i;
+                assert(key >= outer_key_low);
+                assert(key <= outer_key_high);
+                results[i] = f(key);
+                new_bitmap |= (uint64_t)1 << i;
+            }
+            *target = U::make_from_array(new_prefix, new_bitmap, results);
+        }
+    }
+    
+    template<typename T, typename F>
+    latch::signalling_coroutine
+    parallel_persist_generate_outer(latch&,
+                                    PersistentIntMap<T>* target,
+                                    uint64_t outer_key_low,
+                                    uint64_t outer_key_high,
+                                    const F& f,
+                                    execution_policy policy = {}) {
+        latch inner;
+        parallel_persist_generate<T, F>(inner, &(target->_root), outer_key_low, outer_key_high, f, policy);
+        co_await inner;
+        //for (int i = 0; i != 10; ++i) {
+            // work_queues[i].mark_done();
+        //}
+
+    }
+    
+} // namespace aaa
+
+#endif /* parallel_algorithms_hpp */
@@ -16,6 +16,8 @@
 #include <bit>
 #include <utility>
 
+#include "execution_policy.hpp"
+#include "fork.hpp"
 #include "object.hpp"
 #include "latch.hpp"
 
@@ -458,7 +460,8 @@ namespace aaa {
             
         };
         
-        static_assert(sizeof(Node) == 40);
+        // the color moves out to the heap page with side table colors
+        static_assert(sizeof(Node) == (AAA_GC_SIDE_TABLE_COLORS ? 32 : 40));
         
         const Node* _root = nullptr;
         
@@ -500,101 +503,185 @@ namespace aaa {
     parallel_merge_left(latch& outer, // <-- used by coroutine promise
                         const typename PersistentIntMap<T>::Node* a,
                         const typename PersistentIntMap<T>::Node* b,
-                        const typename PersistentIntMap<T>::Node** target
+                        const typename PersistentIntMap<T>::Node** target,
+                        execution_policy policy = {}
                         ) {
         using U = PersistentIntMap<T>::Node;
         
+        // The adopt cases are a trivial fork-join of a single child.  Unless
+        // the policy says to spawn them, we descend into the child in this
+        // frame, and clone the parents we passed through on the way back
+        // out.  Each adoption descends at least one level.
+        const U* parents[11] = {};
+        int depth = 0;
+        const U* d = nullptr;
+        
+        for (;;) {
+            if (!b) {
+                // trivial-left
+                d = a;
+            } else if (!a) {
+                // trivial-right
+                d = b;
+            } else if ((a->_prefix ^ b->_prefix) >> std::max(a->_shift, b->_shift) >> 6) {
+                // trivially-disjoint
+                d = U::make_with_two_children(a, b);
+            } else if (std::max(a->_shift, b->_shift) <= policy.serial_shift) {
+                // too small to be worth spawning
+                d = U::merge_left(a, b);
+            } else if (a->_shift == b->_shift) {
+                // merge-siblings
+                if (a->_shift == 0) {
+                    // leaf-merge - not parallel
+                    assert(b->_shift == 0);
+                    d = U::merge_left(a, b);
+                } else {
+                    // branch-merge - spawn tasks to resolve each prefix collision
+                    uint64_t common = a->_bitmap & b->_bitmap;
+                    // SingleConsumerCountdownEvent event{__builtin_popcountll(common)};
+                    latch inner;
+                    const U* results[64] = {};
+                    int k_a = 0; int k_b = 0;
+                    int n_a = __builtin_popcountll(a->_bitmap);
+                    int n_b = __builtin_popcountll(b->_bitmap);
+                    for (int i = 0; i != 64; ++i) {
+                        uint64_t j = (uint64_t)1 << i;
+                        assert(k_a <= n_a);
+                        assert(k_b <= n_b);
+                        if (j & common) {
+                            assert(k_a < n_a);
+                            assert(k_b < n_b);
+                            parallel_merge_left<T>(inner,
+                                                   a->_children[k_a++],
+                                                   b->_children[k_b++],
+                                                   results + i,
+                                                   policy);
+                        } else if (j & a->_bitmap) {
+                            assert(k_a < n_a);
+                            assert(!(j & b->_bitmap));
+                            results[i] = a->_children[k_a++];
+                        } else if (j & b->_bitmap) {
+                            assert(k_b < n_b);
+                            assert(!(j & a->_bitmap));
+                            results[i] = b->_children[k_b++];
+                        }
+                    }
+                    co_await inner;
+                    // gather results
+                    assert(a->_prefix == b->_prefix);
+                    assert(a->_shift == b->_shift);
+                    uint64_t new_bitmap = a->_bitmap | b->_bitmap;
+                    d = U::make_from_array(a->_prefix, a->_shift, new_bitmap, results);
+                }
+            } else if (b->_shift < a->_shift) {
+                // adopt-parent-child
+                uintptr_t i = (b->_prefix >> a->_shift) & (uint64_t)63;
+                uintptr_t j = (uint64_t)1 << i;
+                uintptr_t k = __builtin_popcountll((j - 1) & a->_bitmap);
+                if (j & a->_bitmap) {
+                    // we must merge
+                    if (policy.inline_single) {
+                        assert(depth < 11);
+                        parents[depth++] = a;
+                        a = a->_children[k]; // <-- respect order
+                        continue;
+                    }
+                    latch inner;
+                    parallel_merge_left<T>(inner, a->_children[k], b, &d, policy); // <-- respect order
+                    co_await inner;
+                } else {
+                    d = b;
+                }
+                d = a->clone_and_insert_or_replace_child(d);
+            } else {
+                // adopt-child-parent
+                assert(a->_shift < b->_shift);
+                uintptr_t i = (a->_prefix >> b->_shift) & (uint64_t)63;
+                uintptr_t j = (uint64_t)1 << i;
+                uintptr_t k = __builtin_popcountll((j - 1) & b->_bitmap);
+                if (j & b->_bitmap) {
+                    // we must merge
+                    if (policy.inline_single) {
+                        assert(depth < 11);
+                        parents[depth++] = b;
+                        b = b->_children[k]; // <-- respect order
+                        continue;
+                    }
+                    latch inner;
+                    parallel_merge_left<T>(inner, a, b->_children[k], &d, policy); // <-- respect order
+                    co_await inner;
+                } else {
+                    d = a;
+                }
+                d = b->clone_and_insert_or_replace_child(d);
+            }
+            break;
+        }
+        
+        while (depth)
+            d = parents[--depth]->clone_and_insert_or_replace_child(d);
+        *target = d;
+        // outer latch is signaled when coroutine completes
+    }
+    
+
+    // parallel_merge_left as continuation-stealing fork/join; children run
+    // inline unless stolen, and single-child cases are plain calls
+    template<typename T>
+    fork_task fork_merge_left(const typename PersistentIntMap<T>::Node* a,
+                              const typename PersistentIntMap<T>::Node* b,
+                              const typename PersistentIntMap<T>::Node** target) {
+        using U = PersistentIntMap<T>::Node;
+        
         if (!b) {
-            // trivial-left
             *target = a;
         } else if (!a) {
-            // trivial-right
             *target = b;
         } else if ((a->_prefix ^ b->_prefix) >> std::max(a->_shift, b->_shift) >> 6) {
-            // trivially-disjoint
             *target = U::make_with_two_children(a, b);
         } else if (a->_shift == b->_shift) {
-            // merge-siblings
             if (a->_shift == 0) {
-                // leaf-merge - not parallel
-                assert(b->_shift == 0);
                 *target = U::merge_left(a, b);
             } else {
-                // branch-merge - spawn tasks to resolve each prefix collision
                 uint64_t common = a->_bitmap & b->_bitmap;
-                // SingleConsumerCountdownEvent event{__builtin_popcountll(common)};
-                latch inner;
                 const U* results[64] = {};
                 int k_a = 0; int k_b = 0;
-                int n_a = __builtin_popcountll(a->_bitmap);
-                int n_b = __builtin_popcountll(b->_bitmap);
                 for (int i = 0; i != 64; ++i) {
                     uint64_t j = (uint64_t)1 << i;
-                    assert(k_a <= n_a);
-                    assert(k_b <= n_b);
                     if (j & common) {
-                        assert(k_a < n_a);
-                        assert(k_b < n_b);
-                        parallel_merge_left<T>(inner,
-                                               a->_children[k_a++],
-                                               b->_children[k_b++],
-                                               results + i);
+                        co_await co_fork{fork_merge_left<T>(a->_children[k_a++],
+                                                            b->_children[k_b++],
+                                                            results + i)};
                     } else if (j & a->_bitmap) {
-                        assert(k_a < n_a);
-                        assert(!(j & b->_bitmap));
                         results[i] = a->_children[k_a++];
                     } else if (j & b->_bitmap) {
-                        assert(k_b < n_b);
-                        assert(!(j & a->_bitmap));
                         results[i] = b->_children[k_b++];
                     }
                 }
-                co_await inner;
-                // gather results
-                assert(a->_prefix == b->_prefix);
-                assert(a->_shift == b->_shift);
+                co_await co_join{};
                 uint64_t new_bitmap = a->_bitmap | b->_bitmap;
                 *target = U::make_from_array(a->_prefix, a->_shift, new_bitmap, results);
             }
         } else if (b->_shift < a->_shift) {
-            // adopt-parent-child
             uintptr_t i = (b->_prefix >> a->_shift) & (uint64_t)63;
             uintptr_t j = (uint64_t)1 << i;
             uintptr_t k = __builtin_popcountll((j - 1) & a->_bitmap);
-            const U* d = nullptr;
-            if (j & a->_bitmap) {
-                // we must merge
-                // TODO: this is a trivial fork-join that should be done
-                // inline, but to do so we need to make parallel_merge_left
-                // generic over its execution policies
-                latch inner;
-                parallel_merge_left<T>(inner, a->_children[k], b, &d); // <-- respect order
-                co_await inner;
-            } else {
-                d = b;
-            }
+            const U* d = b;
+            if (j & a->_bitmap)
+                co_await fork_merge_left<T>(a->_children[k], b, &d); // <-- respect order
             *target = a->clone_and_insert_or_replace_child(d);
         } else {
-            // adopt-child-parent
             assert(a->_shift < b->_shift);
             uintptr_t i = (a->_prefix >> b->_shift) & (uint64_t)63;
             uintptr_t j = (uint64_t)1 << i;
             uintptr_t k = __builtin_popcountll((j - 1) & b->_bitmap);
-            const U* d = nullptr;
-            if (j & b->_bitmap) {
-                // we must merge
-                latch inner;
-                parallel_merge_left<T>(inner, a, b->_children[k], &d); // <-- respect order
-                co_await inner;
-            } else {
-                d = a;
-            }
+            const U* d = a;
+            if (j & b->_bitmap)
+                co_await fork_merge_left<T>(a, b->_children[k], &d); // <-- respect order
             *target = b->clone_and_insert_or_replace_child(d);
         }
-        // outer latch is signaled when coroutine completes
     }
     
-
     inline PersistentIntMap<uint64_t> sneaky;
     
     template<typename T>
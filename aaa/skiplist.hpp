@@ -11,6 +11,7 @@
 #include <cassert>
 #include <cstddef>
 #include <cstdio>
+#include <cstring>
 
 #include <atomic>
 #include <new>
@@ -45,6 +46,27 @@ namespace aaa {
     
     using std::pair;
     
+#if defined(__cpp_lib_forward_like)
+    using std::forward_like;
+#else
+    // libstdc++ < 14 lacks std::forward_like
+    template<typename T, typename U>
+    constexpr auto&& forward_like(U&& x) noexcept {
+        constexpr bool is_adding_const = std::is_const_v<std::remove_reference_t<T>>;
+        if constexpr (std::is_lvalue_reference_v<T&&>) {
+            if constexpr (is_adding_const)
+                return std::as_const(x);
+            else
+                return static_cast<U&>(x);
+        } else {
+            if constexpr (is_adding_const)
+                return std::move(std::as_const(x));
+            else
+                return std::move(x);
+        }
+    }
+#endif
+    
     inline thread_local std::ranlux24_base* thread_local_random_number_generator = nullptr;
     
     /*
@@ -418,7 +440,7 @@ namespace aaa {
             }
                         
             static _node_t* with_size_emplace(size_t n, auto&&... args) {
-                void* raw = arena_allocate(sizeof(_node_t) + sizeof(std::atomic<_node_t*>) * n);
+                void* raw = arena_allocate_aligned(sizeof(_node_t) + sizeof(std::atomic<_node_t*>) * n, alignof(_node_t));
                 return new(raw) _node_t(n, std::forward<decltype(args)>(args)...);
             }
                         
@@ -430,12 +452,12 @@ namespace aaa {
             _array_t _next;
             
             _head_t() : _top(1), _next(33) {
-                std::memset(_next._data, 0, 33*88);
+                std::memset(_next._data, 0, 33 * sizeof(std::atomic<const _node_t*>));
             }
             
             static _head_t* make() {
                 size_t n = 33;
-                void* raw = arena_allocate(sizeof(_head_t) + n * sizeof(std::atomic<const _node_t*>));
+                void* raw = arena_allocate_aligned(sizeof(_head_t) + n * sizeof(std::atomic<const _node_t*>), alignof(_head_t));
                 return new(raw) _head_t;
             }
             
@@ -508,8 +530,10 @@ namespace aaa {
                 _node_t* p = _node_t::with_size_emplace(n, query, std::forward<decltype(args)>(args)...);
                 // Link the lowest level
                 result = _link_level(0, array, candidate, p);
+                // if we lost the race the node is simply abandoned; it was
+                // arena allocated and is reclaimed with the arena
                 if (!result.second)
-                    free(p);
+                    p->~_node_t();
             } else {
                 // Recurse down to emplace
                 result = _emplace(max_level, level - 1, array, query, std::forward<decltype(args)>(args)...);
@@ -532,7 +556,13 @@ namespace aaa {
             if (result.second && result.first->size() > level) {
                 // TODO: limit growth here to one level at a time
                 // Needs to pass "top" down all the way (or read it again)
-                __atomic_fetch_max((size_t*)&(_head->_top), result.first->size(), __ATOMIC_RELAXED);
+                size_t expected = _head->_top.load(std::memory_order_relaxed);
+                while ((expected < result.first->size())
+                       && !_head->_top.compare_exchange_weak(expected,
+                                                             result.first->size(),
+                                                             std::memory_order_relaxed,
+                                                             std::memory_order_relaxed))
+                    ;
                 while (level < result.first->size()) {
                     _link_level(level, &(_head->_next), nullptr, result.first);
                     ++level;
@@ -569,7 +599,7 @@ namespace aaa {
         static decltype(auto) key_if_pair(auto&& query) {
             // TODO: make this a kind(?) comparison
             if constexpr (_is_pair_v<std::decay_t<decltype(query)>>) {
-                return std::forward_like<decltype(query)>(query.first);
+                return forward_like<decltype(query)>(query.first);
             } else {
                 return std::forward<decltype(query)>(query);
             }
@@ -0,0 +1,408 @@
+//
+//  thread_pool.cpp
+//  aaa
+//
+//  Created by Antony Searle on 22/1/2025.
+//
+
+// C
+#include <cassert>
+#include <cstdio>
+
+// C++
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <random>
+#include <thread>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__)
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "allocator.hpp"
+#include "awaitable.hpp"
+#include "gc.hpp"
+#include "skiplist.hpp"
+#include "thread_pool.hpp"
+
+namespace aaa {
+    
+    // Since a thread trying to sleep has nothing to do anyway, we want to
+    // push as much of the cost of the mechanism onto the sleeping thread, and
+    // minimize the burden on the work-generating thread that wakes it up
+    
+    // Once a worker thread has observed all queues to be empty, it
+    // - reads the global sleep generation
+    // - publishes that value to each queue
+    // - rechecks that every queue is still empty
+    // - atomically waits if the global generation has not changed
+    
+    // When a worker thread pushes new work, it needs to wake up anybody who
+    // is sleeping.  But this is an expensive operation, we can't afford to
+    // call it every push.
+    // - pushes new work
+    // - knows of some sleep generation
+    // - reads the local sleep generation
+    // - if the local sleep generation is less than the known generation, nobody
+    //   has tried to sleep since we last checked and we are done
+    // - if the local sleep generation is equal to or greater than the known generation,
+    //   somebody has tried to sleep since we last checked, and we need to wake
+    //   them up with the new work we just pushed
+    // - compare_exchange(expected, local + 1)
+    //   we may discover that we are lagging and the generation was already increased
+    //   then we are done
+    // - otherwise, we are responsible for waking everybody up
+    //
+    // The pusher's (push; fence; load local) and the sleeper's (publish
+    // local; fence; check queues) are a Dekker pair, so at least one of them
+    // sees the other and no work is left stranded with everybody asleep.
+    
+    void _scheduler_wake(_scheduler_binding_t& binding, ptrdiff_t observed) {
+        ptrdiff_t expected = observed;
+        ptrdiff_t desired = observed + 1;
+        bool result = binding.sleep_generation_global
+            ->compare_exchange_strong(expected,
+                                      desired,
+                                      Ordering::RELAXED,
+                                      Ordering::RELAXED);
+        if (result)
+            binding.sleep_generation_global->notify_all();
+        binding.sleep_generation_cached = result ? desired : expected;
+    }
+    
+    // Retired queue arrays are reclaimed by epoch.  A thief publishes the
+    // current epoch for the duration of each steal sweep.  An owner that has
+    // retired arrays advances the epoch; every thief that began a sweep at
+    // the new epoch or later loads the replacement array, so once no sweep
+    // begun earlier is still running the old arrays can be freed.  The
+    // owner does this at its idle points, when its own queue runs dry.
+    
+    bool thread_pool::_reclaim(int index) {
+        worker_t& self = _workers[index];
+        self.queue.shrink();
+        if (self.limbo) {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            for (int k = 0; k != queue_count(); ++k) {
+                uint64_t e = _workers[k].steal_epoch.load(Ordering::ACQUIRE);
+                if (e && (e < self.limbo_epoch))
+                    return false;
+            }
+            queue_type::free_retired(std::exchange(self.limbo, nullptr));
+        }
+        if (const queue_type::circular_array* retired = self.queue.take_retired()) {
+            self.limbo = retired;
+            // Pairs with the fence after a thief publishes its epoch: either
+            // it loads the replacement array, or we see its epoch
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            self.limbo_epoch = _reclaim_epoch.add_fetch(1, Ordering::SEQ_CST);
+            return false;
+        }
+        return true;
+    }
+    
+    void thread_pool::_bind(int index) {
+        _scheduler_binding_t& binding = _tl_scheduler;
+        binding.queue = &_workers[index].queue;
+        binding.sleep_generation_local = &_workers[index].sleep_generation_local;
+        binding.sleep_generation_cached = 0;
+        binding.sleep_generation_global = &_sleep_generation_global;
+    }
+    
+    namespace {
+        
+        void _pin_this_thread(int cpu);
+        
+    } // namespace
+    
+    void thread_pool::_worker_entry(int index) {
+        worker_t& self = _workers[index];
+        // Pin before anything is allocated or first touched, so that the
+        // stack, the thread-locals and the arena start out on our cpu
+        if (self.cpu >= 0)
+            _pin_this_thread(self.cpu);
+        _bind(index);
+        arena_initialize(self.arena);
+        thread_local_random_number_generator = new std::ranlux24_base;
+        gc::mutator_enter();
+        
+        const int n = queue_count();
+        std::coroutine_handle<> work = nullptr;
+        ptrdiff_t sleep_observed = 0;
+        // xorshift64; anything better is wasted on picking victims
+        uint64_t victim_state = 0x9E3779B97F4A7C15ull * (uint64_t)(index + 1);
+        uint64_t frame_acknowledged = 0;
+    
+    POP_OWN:
+        if (!self.queue.pop(work)) {
+            (void) _reclaim(index);
+            goto STEAL_OTHER;
+        }
+    
+    DO_WORK:
+        work.resume();
+        goto POP_OWN;
+    
+    STEAL_OTHER:
+        // Start the sweep at a random victim so that thieves don't convoy
+        // on their low-numbered neighbours, and take half of what we find
+        // so that wide fan-outs are redistributed in a few steals
+        sleep_observed = _sleep_generation_global.load(Ordering::RELAXED);
+        self.steal_epoch.store(_reclaim_epoch.load(Ordering::ACQUIRE), Ordering::RELAXED);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (n > 1) {
+            victim_state ^= victim_state << 13;
+            victim_state ^= victim_state >> 7;
+            victim_state ^= victim_state << 17;
+            int start = (int)(victim_state % (uint64_t)(n - 1));
+            for (int j = 0; j != n - 1; ++j) {
+                int k = (index + 1 + (start + j) % (n - 1)) % n;
+                if (_workers[k].queue.steal_half(work, self.queue)) {
+                    self.steal_epoch.store(0, Ordering::RELEASE);
+                    goto DO_WORK;
+                }
+            }
+        }
+        self.steal_epoch.store(0, Ordering::RELEASE);
+    
+        // try to sleep
+        {
+            if (_done.load(std::memory_order_acquire))
+                goto EXIT;
+            // We are between jobs, so nothing on this thread still uses
+            // the frame's allocations.  The load follows the fence in
+            // STEAL_OTHER; if we missed the frame's end, the wakeup that
+            // announced it will also stop us sleeping on sleep_observed
+            if (uint64_t frame = _frame_epoch.load(Ordering::ACQUIRE); frame != frame_acknowledged) {
+                frame_acknowledged = frame;
+                arena_advance();
+                if (_frame_pending.sub_fetch(1, Ordering::RELEASE) == 0)
+                    _frame_pending.notify_all();
+            }
+            // don't sleep on arrays the last burst left us
+            if (!_reclaim(index)) {
+                std::this_thread::yield();
+                goto STEAL_OTHER;
+            }
+            for (int j = 0; j != n; ++j) {
+                int k = (index + j) % n;
+                ptrdiff_t y = _workers[k].sleep_generation_local.max_fetch(sleep_observed, Ordering::RELAXED);
+                if (y > sleep_observed)
+                    goto STEAL_OTHER;
+            }
+            // Pairs with the fence in schedule_coroutine_handle
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            for (int j = 1; j != n; ++j) {
+                int k = (index + j) % n;
+                if (_workers[k].queue.can_steal())
+                    goto STEAL_OTHER;
+            }
+            // we told every thread we are sleeping without discovering that
+            // our observations were out of date, and anybody who pushes work
+            // after this point will see that and wake us.  A sleeper can't
+            // handshake, so we leave the collector's reckoning until we wake
+            gc::mutator_leave();
+            _sleep_generation_global.wait(sleep_observed, Ordering::RELAXED);
+            gc::mutator_enter();
+            goto STEAL_OTHER;
+        }
+    
+    EXIT:
+        gc::mutator_exit();
+        arena_finalize();
+        delete std::exchange(thread_local_random_number_generator, nullptr);
+        _tl_scheduler = {};
+        
+    }
+    
+    
+    // Frame-based reuse
+    //
+    // The fork-join model results in one final job that knows that it
+    // completes a workflow.  This marks the end of the lifetimes of all the
+    // coroutines and ephemeral helper structures like the skiplist, and we
+    // can now reuse their allocations.  But a worker may still be returning
+    // from the tail of a coroutine whose frame lives in another thread's
+    // arena, so we need a consensus: each worker rewinds its own arena at
+    // an idle point, and only when all have done so does the owner rewind
+    // its own and begin the next frame.  Since a rewound arena is only
+    // written by new work, no thread can overwrite memory that a straggler
+    // is still reading.
+    //
+    // This does mean that if the pool mingles other kinds of work, it has
+    // to use different allocators for different workloads.  An interesting
+    // point to note is that all these difficulties result from the (rapid)
+    // reuse of memory (as in, before it becomes unreachable).
+    
+    void thread_pool::end_frame() {
+        assert(_tl_scheduler.queue == &_workers[0].queue);
+        assert(_frame_pending.load(Ordering::RELAXED) == 0);
+        _frame_pending.store((uint32_t)_worker_count, Ordering::RELAXED);
+        _frame_epoch.add_fetch(1, Ordering::RELEASE);
+        // Wake the sleepers.  The release orders the new frame before the
+        // new generation, for workers that see the latter
+        _sleep_generation_global.add_fetch(1, Ordering::RELEASE);
+        _sleep_generation_global.notify_all();
+        uint32_t pending = _frame_pending.load(Ordering::ACQUIRE);
+        while (pending)
+            _frame_pending.wait(pending, Ordering::ACQUIRE);
+        arena_advance();
+        // all the slabs this frame outgrew are back in the pool
+        arena_pool_tick();
+    }
+    
+    void thread_pool::notify() {
+        _sleep_generation_global.add_fetch(1, Ordering::RELAXED);
+        _sleep_generation_global.notify_all();
+    }
+    
+    int thread_pool::default_worker_count() {
+        // queue 0 belongs to the owning thread
+        int n = (int)std::thread::hardware_concurrency();
+        return (n > 1) ? (n - 1) : 1;
+    }
+    
+    namespace {
+
+#if defined(__linux__)
+        
+        long _read_topology(int cpu, const char* name) {
+            char path[128];
+            snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, name);
+            long value = -1;
+            if (FILE* f = fopen(path, "r")) {
+                if (fscanf(f, "%ld", &value) != 1)
+                    value = -1;
+                fclose(f);
+            }
+            return value;
+        }
+        
+        // The CPUs we may run on, ordered so that the first hardware thread
+        // of every physical core comes before any SMT sibling, and cores are
+        // grouped by package
+        std::vector<int> _cpus_by_topology() {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            if (sched_getaffinity(0, sizeof(set), &set))
+                return {};
+            struct cpu_t {
+                long rank;
+                long package;
+                long core;
+                int cpu;
+            };
+            std::vector<cpu_t> cpus;
+            std::map<std::pair<long, long>, long> siblings;
+            for (int cpu = 0; cpu != CPU_SETSIZE; ++cpu) {
+                if (!CPU_ISSET(cpu, &set))
+                    continue;
+                long package = _read_topology(cpu, "physical_package_id");
+                long core = _read_topology(cpu, "core_id");
+                if (core < 0)
+                    core = cpu;
+                long rank = siblings[{package, core}]++;
+                cpus.push_back(cpu_t{rank, package, core, cpu});
+            }
+            std::sort(cpus.begin(), cpus.end(), [](const cpu_t& a, const cpu_t& b) {
+                return std::tie(a.rank, a.package, a.core, a.cpu) < std::tie(b.rank, b.package, b.core, b.cpu);
+            });
+            std::vector<int> result;
+            for (const cpu_t& c : cpus)
+                result.push_back(c.cpu);
+            return result;
+        }
+        
+        // The NUMA node that sysfs lists the cpu under, or -1
+        int _numa_node_of_cpu(int cpu) {
+            char path[128];
+            snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+            int node = -1;
+            if (DIR* d = opendir(path)) {
+                while (dirent* e = readdir(d)) {
+                    if (sscanf(e->d_name, "node%d", &node) == 1)
+                        break;
+                    node = -1;
+                }
+                closedir(d);
+            }
+            return node;
+        }
+        
+        void _pin_this_thread(int cpu) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpu, &set);
+            int result = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+            if (result)
+                fprintf(stderr, "thread_pool: failed to pin worker to cpu %d (%d)\n", cpu, result);
+        }
+
+#else
+        
+        std::vector<int> _cpus_by_topology() {
+            return {};
+        }
+        
+        int _numa_node_of_cpu(int) {
+            return -1;
+        }
+        
+        void _pin_this_thread(int) {
+        }
+
+#endif
+        
+    } // namespace
+    
+    thread_pool::thread_pool(thread_pool_options options)
+    : _worker_count(options.worker_count ? options.worker_count : default_worker_count())
+    , _workers(new worker_t[_worker_count + 1]) {
+        assert(_worker_count > 0);
+        assert(_tl_scheduler.queue == nullptr);
+        _bind(0);
+        
+        // The owning thread keeps the first cpu in topology order; workers
+        // take the rest round-robin, doubling up only once every cpu we are
+        // allowed to run on is taken
+        std::vector<int> cpus;
+        if (options.pin_workers)
+            cpus = _cpus_by_topology();
+        
+        for (int i = 1; i != queue_count(); ++i) {
+            worker_t& w = _workers[i];
+            if (!cpus.empty())
+                w.cpu = cpus[i % cpus.size()];
+            w.arena.huge_pages = options.huge_page_arenas;
+            // an unpinned worker has no node to be local to
+            if (options.numa_local_arenas && (w.cpu >= 0)) {
+                int node = _numa_node_of_cpu(w.cpu);
+                if (node < ARENA_NUMA_NODES)
+                    w.arena.numa_node = node;
+            }
+            w.thread = std::thread(&thread_pool::_worker_entry, this, i);
+        }
+    }
+    
+    thread_pool::thread_pool(int worker_count)
+    : thread_pool(thread_pool_options{.worker_count = worker_count}) {
+    }
+    
+    thread_pool::~thread_pool() {
+        _done.store(true, std::memory_order_release);
+        notify();
+        for (int i = 1; i != queue_count(); ++i)
+            _workers[i].thread.join();
+        // no thieves remain; the queues free their own retired arrays
+        for (int i = 0; i != queue_count(); ++i)
+            queue_type::free_retired(std::exchange(_workers[i].limbo, nullptr));
+        assert(_tl_scheduler.queue == &_workers[0].queue);
+        _tl_scheduler = {};
+    }
+    
+} // namespace aaa
@@ -0,0 +1,138 @@
+//
+//  thread_pool.hpp
+//  aaa
+//
+//  Created by Antony Searle on 22/1/2025.
+//
+
+#ifndef thread_pool_hpp
+#define thread_pool_hpp
+
+#include <cassert>
+#include <cstdint>
+
+#include <atomic>
+#include <memory>
+#include <thread>
+
+#include "allocator.hpp"
+#include "atomic.hpp"
+#include "awaitable.hpp"
+#include "latch.hpp"
+
+namespace aaa {
+    
+    struct thread_pool_options {
+        // 0 selects one worker per hardware thread, less one for the owner
+        int worker_count = 0;
+        // pin each worker to its own core, preferring distinct physical cores
+        // before SMT siblings; ignored where unsupported
+        bool pin_workers = false;
+        // back worker arenas with huge pages, falling back to ordinary ones
+        bool huge_page_arenas = false;
+        // prefer the NUMA node of each pinned worker's cpu for its arena
+        bool numa_local_arenas = false;
+    };
+    
+    // Work-stealing thread pool
+    //
+    // The thread that constructs the pool keeps queue 0 for itself; it can
+    // schedule work but does not service the queues, so it may block waiting
+    // for results.  Workers own queues 1 through worker_count.
+    //
+    // The constructing thread must already be a gc mutator with an arena.
+    // Only one pool may be live per owning thread.
+    
+    struct thread_pool {
+        
+        using queue_type = _scheduler_queue_t;
+        
+        struct worker_t {
+            queue_type queue;
+            // sleep generation last published to this queue by a thread
+            // trying to sleep
+            alignas(CACHE_LINE_SIZE) Atomic<ptrdiff_t> sleep_generation_local{0};
+            // the reclaim epoch at which this worker began its current steal
+            // sweep, or 0 outside one
+            Atomic<uint64_t> steal_epoch{0};
+            // arrays retired by our queue that thieves may still be reading,
+            // until no thief remains in a sweep begun before limbo_epoch
+            const queue_type::circular_array* limbo = nullptr;
+            uint64_t limbo_epoch = 0;
+            std::thread thread;
+            int cpu = -1;
+            arena_options arena;
+        };
+        
+        int _worker_count;
+        std::unique_ptr<worker_t[]> _workers;
+        alignas(CACHE_LINE_SIZE) Atomic<ptrdiff_t> _sleep_generation_global{0};
+        alignas(CACHE_LINE_SIZE) Atomic<uint64_t> _reclaim_epoch{1};
+        // frames ended by the owner, and workers yet to rewind their arenas
+        // for the latest
+        alignas(CACHE_LINE_SIZE) Atomic<uint64_t> _frame_epoch{0};
+        Atomic<uint32_t> _frame_pending{0};
+        std::atomic<bool> _done{false};
+        
+        static int default_worker_count();
+        
+        explicit thread_pool(thread_pool_options options = {});
+        explicit thread_pool(int worker_count);
+        thread_pool(const thread_pool&) = delete;
+        ~thread_pool();
+        thread_pool& operator=(const thread_pool&) = delete;
+        
+        int worker_count() const { return _worker_count; }
+        int queue_count() const { return _worker_count + 1; }
+        
+        // Wake any sleeping workers to rescan the queues.  Scheduling work
+        // already does this; it is needed only for changes in pool state
+        void notify();
+        
+        // Bind the calling thread's scheduler state to queue index
+        void _bind(int index);
+        
+        // Shrink queue index and free its retired arrays once no thief can
+        // be reading them; true when nothing is left awaiting reclamation
+        bool _reclaim(int index);
+        
+        // Run f(latch&), which is expected to spawn signalling coroutines on
+        // the latch, on the pool and block the owning thread until they
+        // complete
+        template<typename F>
+        void block_on(F&& f);
+        
+        // End a frame: once every worker has acknowledged from an idle
+        // point, every thread's arena is rewound for reuse, and the slab
+        // pool ages by a frame.  Called by the owning thread between calls
+        // to block_on, when nothing allocated from any arena since the last
+        // frame ended is still reachable
+        void end_frame();
+        
+        void _worker_entry(int index);
+        
+    }; // struct thread_pool
+    
+    template<typename F>
+    co_void _thread_pool_block_on(F& f, Atomic<uint32_t>& done) {
+        latch inner;
+        f(inner);
+        co_await inner;
+        done.store(1, Ordering::RELEASE);
+        done.notify_all();
+    }
+    
+    template<typename F>
+    void thread_pool::block_on(F&& f) {
+        assert(_tl_scheduler.queue == &_workers[0].queue);
+        Atomic<uint32_t> done{0};
+        _thread_pool_block_on(f, done);
+        uint32_t expected = 0;
+        while (!expected)
+            done.wait(expected, Ordering::ACQUIRE);
+        (void) _reclaim(0);
+    }
+    
+} // namespace aaa
+
+#endif /* thread_pool_hpp */
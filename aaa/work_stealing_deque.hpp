@@ -9,16 +9,20 @@
 #define work_stealing_deque_hpp
 
 #include <cassert>
+#include <cstdlib>
 
+#include <algorithm>
 #include <atomic>
 #include <bit>
+#include <memory_resource>
+#include <new>
+#include <utility>
 
 #include <sanitizer/tsan_interface.h>
 
-#include "object.hpp"
 
 namespace aaa {
-        
+    
     namespace _work_stealing_deque {
         
         // A lock-free, unbounded SPMC deque suitable for work-stealing
@@ -35,38 +39,63 @@ namespace aaa {
         // PPoPP ’13 - Proceedings of the 18th ACM SIGPLAN symposium on
         // Principles and practice of parallel programming, Feb 2013, Shenzhen,
         // China. pp.69-80, ff10.1145/2442516.2442524ff. ffhal-00802885f
-    
-                    
+        
+        
         template<typename T>
         concept AlwaysLockFreeAtomic = std::atomic<T>::is_always_lock_free;
-                
+        
         template<AlwaysLockFreeAtomic T>
         struct work_stealing_deque {
-
+            
             constexpr static std::size_t CACHE_LINE_SIZE = 128;
             constexpr static std::size_t INITIAL_CAPACITY = 16;
-
-            struct circular_array : gc::Object {
+            constexpr static std::size_t STEAL_BATCH_LIMIT = 8;
+            
+            // Arrays are not garbage collected.  An array replaced by growing
+            // or shrinking may still be read by a thief that loaded it
+            // earlier, so the owner retires it to a list, and whoever
+            // coordinates the thieves frees the list with free_retired once
+            // no thief can still hold it (see thread_pool)
+            //
+            // Arrays come from malloc, or from a memory resource the owner
+            // names at construction, which each array remembers so that
+            // free_retired can return it
+            
+            struct circular_array {
                 
                 std::size_t _mask;
+                mutable const circular_array* _next_retired;
+                std::pmr::memory_resource* _resource;
                 mutable std::atomic<T> _data[0];
                 
                 std::size_t capacity() const { return _mask + 1; }
                 
-                explicit circular_array(std::size_t mask)
-                : gc::Object()
-                , _mask(mask) {
+                std::size_t bytes() const { return sizeof(circular_array) + sizeof(T) * capacity(); }
+                
+                circular_array(std::size_t mask, std::pmr::memory_resource* resource)
+                : _mask(mask)
+                , _next_retired(nullptr)
+                , _resource(resource) {
                     assert(std::has_single_bit(_mask + 1));
                 }
                 
-                static circular_array* make(std::size_t capacity) {
-                    // void* raw = calloc(sizeof(circular_array) + sizeof(T) * capacity, 1);
-                    void* raw = operator new(sizeof(circular_array) + sizeof(T) * capacity);
+                static circular_array* make(std::size_t capacity, std::pmr::memory_resource* resource) {
+                    std::size_t bytes = sizeof(circular_array) + sizeof(T) * capacity;
+                    void* raw = (resource
+                                 ? resource->allocate(bytes, alignof(circular_array))
+                                 : malloc(bytes));
+                    if (!raw)
+                        throw std::bad_alloc();
                     std::size_t mask = capacity - 1;
-                    return new(raw) circular_array(mask);
+                    return new(raw) circular_array(mask, resource);
                 }
                 
-                virtual void _object_scan() const override {}
+                static void destroy(const circular_array* array) {
+                    if (array->_resource)
+                        array->_resource->deallocate((void*)array, array->bytes(), alignof(circular_array));
+                    else
+                        free((void*)array);
+                }
                 
                 std::atomic<T>& operator[](size_t i) const {
                     return _data[i & _mask];
@@ -75,25 +104,91 @@ namespace aaa {
             };
             
             // written by owner
-            alignas(CACHE_LINE_SIZE) struct {
-                mutable std::atomic<const circular_array*> _array;
-                mutable std::atomic<std::ptrdiff_t> _bottom;
-                mutable std::ptrdiff_t _cached_top;
-            };
-
+            alignas(CACHE_LINE_SIZE) mutable std::atomic<const circular_array*> _array;
+            mutable std::atomic<std::ptrdiff_t> _bottom;
+            mutable std::ptrdiff_t _cached_top;
+            mutable const circular_array* _retired;
+            
             // written by owner and thief
-            alignas(CACHE_LINE_SIZE) struct {
-                mutable std::atomic<std::ptrdiff_t> _top;
-            };
+            alignas(CACHE_LINE_SIZE) mutable std::atomic<std::ptrdiff_t> _top;
             
-            work_stealing_deque()
-            : _array(circular_array::make(INITIAL_CAPACITY))
+            explicit work_stealing_deque(std::pmr::memory_resource* resource = nullptr)
+            : _array(circular_array::make(INITIAL_CAPACITY, resource))
             , _bottom(0)
             , _cached_top(0)
+            , _retired(nullptr)
             , _top(0) {
             }
             
+            work_stealing_deque(const work_stealing_deque&) = delete;
+            
+            // no thieves may remain
+            ~work_stealing_deque() {
+                free_retired(_retired);
+                circular_array::destroy(_array.load(std::memory_order_relaxed));
+            }
+            
+            work_stealing_deque& operator=(const work_stealing_deque&) = delete;
+            
+            // called by owner thread
+            void _replace_array(const circular_array* array,
+                                std::ptrdiff_t top,
+                                std::ptrdiff_t bottom,
+                                std::size_t capacity) const {
+                circular_array* new_array = circular_array::make(capacity, array->_resource);
+                for (std::ptrdiff_t i = top; i != bottom; ++i) {
+                    T jtem = (*array)[i].load(std::memory_order_relaxed);
+                    (*new_array)[i].store(jtem, std::memory_order_relaxed);
+                }
+                this->_array.store(new_array, std::memory_order_release);
+                array->_next_retired = _retired;
+                _retired = array;
+            }
+            
+            // called by owner thread
+            //
+            // When the deque has drained to a small fraction of its
+            // capacity, as at the end of a burst, copy what is left into a
+            // smaller array and retire the large one
+            void shrink() const {
+                std::ptrdiff_t bottom = this->_bottom.load(std::memory_order_relaxed);
+                const circular_array* array = this->_array.load(std::memory_order_relaxed);
+                std::size_t capacity = array->capacity();
+                if (capacity <= INITIAL_CAPACITY)
+                    return;
+                this->_cached_top = this->_top.load(std::memory_order_acquire);
+                std::size_t size = (std::size_t)(bottom - this->_cached_top);
+                if (size * 4 > capacity)
+                    return;
+                std::size_t new_capacity = std::max(INITIAL_CAPACITY, std::bit_ceil(size * 2));
+                _replace_array(array, this->_cached_top, bottom, new_capacity);
+            }
+            
+            // called by owner thread
+            //
+            // Hands over the arrays retired since the last call
+            const circular_array* take_retired() const {
+                return std::exchange(_retired, nullptr);
+            }
+            
+            static void free_retired(const circular_array* list) {
+                while (list) {
+                    const circular_array* next = list->_next_retired;
+                    circular_array::destroy(list);
+                    list = next;
+                }
+            }
+            
             // called by owner thread
+            //
+            // Items within STEAL_BATCH_LIMIT of _top may be claimed by a
+            // batched steal that read a stale _bottom, so the owner only
+            // takes its own items uncontended while it has more than that
+            // left.  For the last few it claims everything left with one CAS
+            // on _top, keeps the newest and republishes the rest above it,
+            // so that pop stays strictly LIFO as fork/join requires.  (The
+            // republished items are briefly invisible to thieves; we are
+            // awake and will get to them, so sleepers are not woken.)
             bool pop(T& item) const {
                 std::ptrdiff_t bottom = this->_bottom.load(std::memory_order_relaxed);
                 const circular_array* array = this->_array.load(std::memory_order_relaxed);
@@ -102,25 +197,45 @@ namespace aaa {
                 std::atomic_thread_fence(std::memory_order_seq_cst);
                 this->_cached_top = this->_top.load(std::memory_order_relaxed);
                 assert(this->_cached_top <= bottom);
-                std::ptrdiff_t new_top = this->_cached_top + 1;
                 std::ptrdiff_t new_size = new_bottom - this->_cached_top;
                 if (new_size < 0) {
                     this->_bottom.store(bottom, std::memory_order_relaxed);
                     return false;
                 }
-                item = (*array)[new_bottom].load(std::memory_order_relaxed);
-                if (new_size > 0)
+                if (new_size >= (std::ptrdiff_t)STEAL_BATCH_LIMIT) {
+                    item = (*array)[new_bottom].load(std::memory_order_relaxed);
                     return true;
-                assert(new_size == 0);
-                bool success = this->_top.compare_exchange_strong(this->_cached_top,
-                                                                  new_top,
-                                                                  std::memory_order_seq_cst,
-                                                                  std::memory_order_relaxed);
-                assert(bottom == new_top);
-                this->_bottom.store(bottom, std::memory_order_relaxed);
-                return success;
+                }
+                std::ptrdiff_t top = this->_cached_top;
+                while (!this->_top.compare_exchange_strong(top,
+                                                           bottom,
+                                                           std::memory_order_seq_cst,
+                                                           std::memory_order_relaxed)) {
+                    if (!(top < bottom)) {
+                        // thieves took everything
+                        this->_cached_top = top;
+                        this->_bottom.store(bottom, std::memory_order_relaxed);
+                        return false;
+                    }
+                }
+                // we own [top, bottom)
+                item = (*array)[new_bottom].load(std::memory_order_relaxed);
+                std::ptrdiff_t count = new_bottom - top;
+                for (std::ptrdiff_t i = 0; i != count; ++i) {
+                    T jtem = (*array)[top + i].load(std::memory_order_relaxed);
+                    (*array)[bottom + i].store(jtem, std::memory_order_relaxed);
+                }
+                this->_cached_top = bottom;
+                std::atomic_thread_fence(std::memory_order_release);
+#if defined(__has_feature)
+#    if __has_feature(thread_sanitizer)
+                __tsan_release(&_top);
+#    endif
+#endif
+                this->_bottom.store(bottom + count, std::memory_order_relaxed);
+                return true;
             }
-
+            
             // called by owner thread
             void push(T item) const {
                 std::ptrdiff_t bottom = this->_bottom.load(std::memory_order_relaxed);
@@ -131,14 +246,8 @@ namespace aaa {
                     this->_cached_top = this->_top.load(std::memory_order_acquire);
                     assert(bottom - this->_cached_top <= capacity);
                     if (bottom - this->_cached_top == capacity) [[unlikely]] {
-                        circular_array* new_array = circular_array::make(capacity << 1);
-                        for (std::ptrdiff_t i = this->_cached_top; i != bottom; ++i) {
-                            T jtem = (*array)[i].load(std::memory_order_relaxed);
-                            (*new_array)[i].store(jtem, std::memory_order_relaxed);
-                        }
-                        array->_object_shade();
-                        this->_array.store(new_array, std::memory_order_release);
-                        array = new_array;
+                        _replace_array(array, this->_cached_top, bottom, capacity << 1);
+                        array = this->_array.load(std::memory_order_relaxed);
                     }
                 }
                 (*array)[bottom].store(item, std::memory_order_relaxed);
@@ -152,7 +261,38 @@ namespace aaa {
 #endif
                 this->_bottom.store(bottom + 1, std::memory_order_relaxed);
             }
-
+            
+            // called by any thief thread
+            //
+            // Steals the oldest item into item and moves up to half the rest,
+            // at most STEAL_BATCH_LIMIT in all, into the thief's own deque
+            // with a single CAS.  Returns the number of items taken.
+            template<typename Destination>
+            std::size_t steal_half(T& item, const Destination& destination) const {
+                assert((const void*)&destination != (const void*)this);
+                std::ptrdiff_t top = this->_top.load(std::memory_order_acquire);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                std::ptrdiff_t bottom = this->_bottom.load(std::memory_order_acquire);
+                std::ptrdiff_t size = bottom - top;
+                if (!(size > 0))
+                    return 0;
+                std::ptrdiff_t count = std::min<std::ptrdiff_t>((size + 1) >> 1, STEAL_BATCH_LIMIT);
+                const circular_array* array = this->_array.load(std::memory_order_consume);
+                T batch[STEAL_BATCH_LIMIT];
+                for (std::ptrdiff_t i = 0; i != count; ++i)
+                    batch[i] = (*array)[top + i].load(std::memory_order_relaxed);
+                if (!this->_top.compare_exchange_strong(top,
+                                                        top + count,
+                                                        std::memory_order_seq_cst,
+                                                        std::memory_order_relaxed))
+                    return 0;
+                item = batch[0];
+                // newest last, so the thief pops them in the victim's order
+                for (std::ptrdiff_t i = 1; i != count; ++i)
+                    destination.push(batch[i]);
+                return (std::size_t)count;
+            }
+            
             // called by any thief thread
             bool steal(T& item) const {
                 std::ptrdiff_t top = this->_top.load(std::memory_order_acquire);
@@ -189,15 +329,212 @@ namespace aaa {
                 std::ptrdiff_t top = this->_top.load(std::memory_order_acquire);
                 std::atomic_thread_fence(std::memory_order_seq_cst);
                 std::ptrdiff_t bottom = this->_bottom.load(std::memory_order_acquire);
-                return !(top < bottom);
+                return top < bottom;
             }
             
         }; // work_stealing_deque
         
         
+        // A fixed-capacity work_stealing_deque with its slots inline
+        //
+        // There is no array pointer to chase on pop or steal, and the whole
+        // hot deque is one contiguous block that can sit next to the rest of
+        // a worker's state.  When the inline slots are full, pushes spill
+        // to an unbounded work_stealing_deque until the owner drains it
+        // again.  The owner pops the spilled (newest) items first and thieves
+        // steal the inline (oldest) items first, and either end falls back to
+        // the other, so the owner still sees LIFO order.
+        //
+        // Only the overflow ever allocates, so growth, shrink and retired
+        // arrays are delegated to it.
+        
+        template<AlwaysLockFreeAtomic T, std::size_t CAPACITY>
+        struct bounded_work_stealing_deque {
+            
+            static_assert(std::has_single_bit(CAPACITY));
+            
+            using overflow_type = work_stealing_deque<T>;
+            using circular_array = typename overflow_type::circular_array;
+            
+            constexpr static std::size_t CACHE_LINE_SIZE = overflow_type::CACHE_LINE_SIZE;
+            constexpr static std::size_t STEAL_BATCH_LIMIT = overflow_type::STEAL_BATCH_LIMIT;
+            constexpr static std::size_t MASK = CAPACITY - 1;
+            
+            static_assert(CAPACITY > STEAL_BATCH_LIMIT);
+            
+            // written by owner
+            alignas(CACHE_LINE_SIZE) mutable std::atomic<std::ptrdiff_t> _bottom;
+            mutable std::ptrdiff_t _cached_top;
+            // the overflow may hold items; only the owner pushes to it, but
+            // thieves may empty it
+            mutable bool _spilled;
+            
+            // written by owner and thief
+            alignas(CACHE_LINE_SIZE) mutable std::atomic<std::ptrdiff_t> _top;
+            
+            alignas(CACHE_LINE_SIZE) mutable std::atomic<T> _data[CAPACITY];
+            
+            overflow_type _overflow;
+            
+            bounded_work_stealing_deque()
+            : _bottom(0)
+            , _cached_top(0)
+            , _spilled(false)
+            , _top(0) {
+            }
+            
+            bounded_work_stealing_deque(const bounded_work_stealing_deque&) = delete;
+            bounded_work_stealing_deque& operator=(const bounded_work_stealing_deque&) = delete;
+            
+            // called by owner thread
+            void push(T item) const {
+                if (_spilled) [[unlikely]] {
+                    // keep the newest items together in the overflow
+                    _overflow.push(item);
+                    return;
+                }
+                std::ptrdiff_t bottom = this->_bottom.load(std::memory_order_relaxed);
+                assert(bottom - this->_cached_top <= (std::ptrdiff_t)CAPACITY);
+                if (bottom - this->_cached_top == (std::ptrdiff_t)CAPACITY) {
+                    this->_cached_top = this->_top.load(std::memory_order_acquire);
+                    if (bottom - this->_cached_top == (std::ptrdiff_t)CAPACITY) [[unlikely]] {
+                        _spilled = true;
+                        _overflow.push(item);
+                        return;
+                    }
+                }
+                _data[bottom & MASK].store(item, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_release);
+#if defined(__has_feature)
+#    if __has_feature(thread_sanitizer)
+                __tsan_release(&_top);
+#    endif
+#endif
+                this->_bottom.store(bottom + 1, std::memory_order_relaxed);
+            }
+            
+            // called by owner thread
+            //
+            // As work_stealing_deque::pop
+            bool pop(T& item) const {
+                if (_spilled) [[unlikely]] {
+                    if (_overflow.pop(item))
+                        return true;
+                    _spilled = false;
+                }
+                std::ptrdiff_t bottom = this->_bottom.load(std::memory_order_relaxed);
+                std::ptrdiff_t new_bottom = bottom - 1;
+                this->_bottom.store(new_bottom, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                this->_cached_top = this->_top.load(std::memory_order_relaxed);
+                assert(this->_cached_top <= bottom);
+                std::ptrdiff_t new_size = new_bottom - this->_cached_top;
+                if (new_size < 0) {
+                    this->_bottom.store(bottom, std::memory_order_relaxed);
+                    return false;
+                }
+                if (new_size >= (std::ptrdiff_t)STEAL_BATCH_LIMIT) {
+                    item = _data[new_bottom & MASK].load(std::memory_order_relaxed);
+                    return true;
+                }
+                std::ptrdiff_t top = this->_cached_top;
+                while (!this->_top.compare_exchange_strong(top,
+                                                           bottom,
+                                                           std::memory_order_seq_cst,
+                                                           std::memory_order_relaxed)) {
+                    if (!(top < bottom)) {
+                        this->_cached_top = top;
+                        this->_bottom.store(bottom, std::memory_order_relaxed);
+                        return false;
+                    }
+                }
+                item = _data[new_bottom & MASK].load(std::memory_order_relaxed);
+                std::ptrdiff_t count = new_bottom - top;
+                for (std::ptrdiff_t i = 0; i != count; ++i) {
+                    T jtem = _data[(top + i) & MASK].load(std::memory_order_relaxed);
+                    _data[(bottom + i) & MASK].store(jtem, std::memory_order_relaxed);
+                }
+                this->_cached_top = bottom;
+                std::atomic_thread_fence(std::memory_order_release);
+#if defined(__has_feature)
+#    if __has_feature(thread_sanitizer)
+                __tsan_release(&_top);
+#    endif
+#endif
+                this->_bottom.store(bottom + count, std::memory_order_relaxed);
+                return true;
+            }
+            
+            // called by any thief thread
+            bool steal(T& item) const {
+                std::ptrdiff_t top = this->_top.load(std::memory_order_acquire);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                std::ptrdiff_t bottom = this->_bottom.load(std::memory_order_acquire);
+                if (!(top < bottom))
+                    return _overflow.steal(item);
+                item = _data[top & MASK].load(std::memory_order_relaxed);
+                std::ptrdiff_t new_top = top + 1;
+                return this->_top.compare_exchange_strong(top,
+                                                          new_top,
+                                                          std::memory_order_seq_cst,
+                                                          std::memory_order_relaxed);
+            }
+            
+            // called by any thief thread
+            //
+            // As work_stealing_deque::steal_half
+            template<typename Destination>
+            std::size_t steal_half(T& item, const Destination& destination) const {
+                assert((const void*)&destination != (const void*)this);
+                std::ptrdiff_t top = this->_top.load(std::memory_order_acquire);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                std::ptrdiff_t bottom = this->_bottom.load(std::memory_order_acquire);
+                std::ptrdiff_t size = bottom - top;
+                if (!(size > 0))
+                    return _overflow.steal_half(item, destination);
+                std::ptrdiff_t count = std::min<std::ptrdiff_t>((size + 1) >> 1, STEAL_BATCH_LIMIT);
+                T batch[STEAL_BATCH_LIMIT];
+                for (std::ptrdiff_t i = 0; i != count; ++i)
+                    batch[i] = _data[(top + i) & MASK].load(std::memory_order_relaxed);
+                if (!this->_top.compare_exchange_strong(top,
+                                                        top + count,
+                                                        std::memory_order_seq_cst,
+                                                        std::memory_order_relaxed))
+                    return 0;
+                item = batch[0];
+                for (std::ptrdiff_t i = 1; i != count; ++i)
+                    destination.push(batch[i]);
+                return (std::size_t)count;
+            }
+            
+            // called by termination-detecting thief
+            bool can_steal() const {
+                std::ptrdiff_t top = this->_top.load(std::memory_order_acquire);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                std::ptrdiff_t bottom = this->_bottom.load(std::memory_order_acquire);
+                return (top < bottom) || _overflow.can_steal();
+            }
+            
+            // called by owner thread
+            void shrink() const {
+                _overflow.shrink();
+            }
+            
+            // called by owner thread
+            const circular_array* take_retired() const {
+                return _overflow.take_retired();
+            }
+            
+            static void free_retired(const circular_array* list) {
+                overflow_type::free_retired(list);
+            }
+            
+        }; // bounded_work_stealing_deque
+        
     } // namespace _work_stealing_deque
     
     using _work_stealing_deque::work_stealing_deque;
+    using _work_stealing_deque::bounded_work_stealing_deque;
     
 }
 
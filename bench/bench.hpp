@@ -0,0 +1,107 @@
+//
+//  bench.hpp
+//  aaa
+//
+//  Created by Antony Searle on 22/1/2025.
+//
+
+#ifndef bench_hpp
+#define bench_hpp
+
+#include <cstdint>
+#include <cstdio>
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <string_view>
+#include <vector>
+
+namespace aaa::bench {
+    
+    // Minimal benchmark registry
+    //
+    //     define_benchmark("name") {
+    //         ...
+    //         emit("name", "variant", threads, size, ns_per_op);
+    //     };
+    //
+    // Results are emitted as JSON lines on stdout so they can be collected and
+    // compared across runs; human-readable chatter goes to stderr.
+    //
+    // Benchmarks that are parameterized by problem size or thread count
+    // should iterate over options.sizes and options.threads, which are set
+    // from the command line.
+    
+    struct Options {
+        std::vector<long> sizes = { 1 << 14, 1 << 17 };
+        std::vector<long> threads = { 1, 2, 4 };
+        long repetitions = 3;
+    };
+    
+    inline Options options;
+    
+    struct Benchmark {
+        
+        const char* name;
+        void (*function)();
+        Benchmark* next;
+        
+        explicit Benchmark(const char* name)
+        : name(name)
+        , function(nullptr)
+        , next(nullptr) {
+        }
+        
+    };
+    
+    inline Benchmark* registry_head = nullptr;
+    
+    inline Benchmark& operator+(Benchmark&& benchmark, void (*function)()) {
+        Benchmark* node = new Benchmark(benchmark);
+        node->function = function;
+        node->next = registry_head;
+        registry_head = node;
+        return *node;
+    }
+    
+    inline uint64_t now_ns() {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+    
+    // Fastest of options.repetitions runs of f(), in nanoseconds
+    template<typename F>
+    double best_of(F&& f) {
+        uint64_t best = std::numeric_limits<uint64_t>::max();
+        for (long i = 0; i != options.repetitions; ++i) {
+            uint64_t t0 = now_ns();
+            f();
+            uint64_t t1 = now_ns();
+            best = std::min(best, t1 - t0);
+        }
+        return (double)best;
+    }
+    
+    inline void emit(std::string_view benchmark,
+                     std::string_view variant,
+                     long threads,
+                     long size,
+                     double ns_per_op) {
+        printf("{\"benchmark\":\"%.*s\",\"variant\":\"%.*s\",\"threads\":%ld,\"size\":%ld,\"ns_per_op\":%.3f}\n",
+               (int)benchmark.size(), benchmark.data(),
+               (int)variant.size(), variant.data(),
+               threads,
+               size,
+               ns_per_op);
+        fflush(stdout);
+    }
+    
+} // namespace aaa::bench
+
+#define AAA_BENCH_CONCATENATE2(X, Y) X##Y
+#define AAA_BENCH_CONCATENATE(X, Y) AAA_BENCH_CONCATENATE2(X, Y)
+
+#define define_benchmark(NAME) \
+[[maybe_unused]] static ::aaa::bench::Benchmark& AAA_BENCH_CONCATENATE(_benchmark_, __LINE__) = ::aaa::bench::Benchmark(NAME) + []
+
+#endif /* bench_hpp */
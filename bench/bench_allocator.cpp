@@ -0,0 +1,136 @@
+//
+//  bench_allocator.cpp
+//  aaa
+//
+//  Created by Antony Searle on 24/1/2025.
+//
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+
+#include <thread>
+
+#include "allocator.hpp"
+#include "bench.hpp"
+#include "heap.hpp"
+
+namespace aaa {
+    
+    namespace {
+        
+        // Allocations the size of coroutine frames, made and released in
+        // bursts as a task spawning a handful of children and joining them
+        // does.  malloc pays for general-purpose bookkeeping on both ends;
+        // the arena only bumps a pointer, but never reuses anything before
+        // the frame ends; the recyclable arena reuses blocks from its size
+        // class free lists, so the working set stays in cache.
+        
+        constexpr size_t FRAME_SIZES[] = { 96, 160, 224, 288 };
+        constexpr long BURST = 8;
+        
+        template<typename Allocate, typename Release, typename Reset>
+        double frame_ns_per_allocation(long count, Allocate&& allocate, Release&& release, Reset&& reset) {
+            void* blocks[BURST];
+            uintptr_t sum = 0;
+            double t = bench::best_of([&]() {
+                for (long i = 0; i != count; i += BURST) {
+                    for (long j = 0; j != BURST; ++j) {
+                        size_t n = FRAME_SIZES[(i + j) & 3];
+                        blocks[j] = allocate(n);
+                        *(unsigned char*)blocks[j] = (unsigned char)j;
+                    }
+                    for (long j = BURST; j--;) {
+                        sum += *(unsigned char*)blocks[j];
+                        release(blocks[j], FRAME_SIZES[(i + j) & 3]);
+                    }
+                }
+                reset();
+            });
+            if (sum == 1)
+                fprintf(stderr, "unreachable\n");
+            return t / count;
+        }
+        
+        void no_reset() {
+        }
+        
+        define_benchmark("arena_frame_allocate") {
+            // on a thread of its own, so that we may rewind its arena
+            std::thread([]() {
+                arena_initialize();
+                for (long n : bench::options.sizes) {
+                    bench::emit("arena_frame_allocate", "malloc", 1, n,
+                                frame_ns_per_allocation(n,
+                                                        [](size_t n) { return malloc(n); },
+                                                        [](void* p, size_t) { free(p); },
+                                                        no_reset));
+                    bench::emit("arena_frame_allocate", "arena", 1, n,
+                                frame_ns_per_allocation(n,
+                                                        [](size_t n) { return arena_allocate(n); },
+                                                        [](void*, size_t) {},
+                                                        arena_advance));
+                    bench::emit("arena_frame_allocate", "arena_recyclable", 1, n,
+                                frame_ns_per_allocation(n,
+                                                        [](size_t n) { return arena_allocate_recyclable(n); },
+                                                        [](void* p, size_t n) { arena_recycle(p, n); },
+                                                        arena_advance));
+                }
+                arena_finalize();
+            }).join();
+        };
+        
+        // The same allocations, never released, from the upward-bumping
+        // arena and the downward-bumping BumpAllocator
+        
+        define_benchmark("bump_allocate") {
+            std::thread([]() {
+                arena_initialize();
+                BumpAllocator* bump = nullptr;
+                auto release = [](void*, size_t) {};
+                for (long n : bench::options.sizes) {
+                    bench::emit("bump_allocate", "arena", 1, n,
+                                frame_ns_per_allocation(n,
+                                                        [](size_t n) { return arena_allocate(n); },
+                                                        release,
+                                                        arena_advance));
+                    bench::emit("bump_allocate", "arena_aligned", 1, n,
+                                frame_ns_per_allocation(n,
+                                                        [](size_t n) { return arena_allocate_aligned(n, 16); },
+                                                        release,
+                                                        arena_advance));
+                    bench::emit("bump_allocate", "bump_aligned", 1, n,
+                                frame_ns_per_allocation(n,
+                                                        [&](size_t n) { return bump_allocator_aligned_alloc(bump, 16, n); },
+                                                        release,
+                                                        [&]() { bump_allocator_reset(bump); }));
+                }
+                bump_allocator_release(bump);
+                arena_finalize();
+            }).join();
+        };
+        
+        // The same sizes, which are also those of trie nodes, from calloc
+        // and from the gc heap that replaced it for gc::Objects
+        
+        define_benchmark("gc_heap_allocate") {
+            std::thread([]() {
+                for (long n : bench::options.sizes) {
+                    bench::emit("gc_heap_allocate", "calloc", 1, n,
+                                frame_ns_per_allocation(n,
+                                                        [](size_t n) { return calloc(n, 1); },
+                                                        [](void* p, size_t) { free(p); },
+                                                        no_reset));
+                    bench::emit("gc_heap_allocate", "heap", 1, n,
+                                frame_ns_per_allocation(n,
+                                                        [](size_t n) { return gc::heap_allocate(n); },
+                                                        [](void* p, size_t) { gc::heap_deallocate(p); },
+                                                        no_reset));
+                }
+                gc::heap_flush();
+            }).join();
+        };
+        
+    } // namespace
+    
+} // namespace aaa
@@ -0,0 +1,98 @@
+//
+//  bench_atomic.cpp
+//  aaa
+//
+//  Created by Antony Searle on 22/1/2025.
+//
+
+#include <thread>
+
+#include "atomic.hpp"
+#include "bench.hpp"
+
+namespace aaa {
+    
+    namespace {
+        
+        // Two threads pass a token back and forth through one Atomic.  Each
+        // handoff is one store by the sender and one wakeup of the receiver,
+        // so the round-trip time is twice the wake latency.
+        //
+        // Spinning gives the floor; the waiting variants show what it costs
+        // to actually sleep the receiver and have the kernel wake it
+        
+        template<typename T, bool SPIN>
+        double ping_pong_ns_per_round_trip(long rounds) {
+            Atomic<T> token{0};
+            auto await_change = [&token](T& expected) {
+                if constexpr (SPIN) {
+                    for (;;) {
+                        T discovered = token.load(Ordering::ACQUIRE);
+                        if (discovered != expected) {
+                            expected = discovered;
+                            return;
+                        }
+                    }
+                } else {
+                    token.wait(expected, Ordering::ACQUIRE);
+                }
+            };
+            std::thread partner([&]() {
+                T expected = 0;
+                for (long i = 0; i != rounds; ++i) {
+                    await_change(expected);
+                    token.store(expected + 1, Ordering::RELEASE);
+                    expected += 1;
+                    if constexpr (!SPIN)
+                        token.notify_one();
+                }
+            });
+            uint64_t t0 = bench::now_ns();
+            T expected = 0;
+            for (long i = 0; i != rounds; ++i) {
+                token.store(expected + 1, Ordering::RELEASE);
+                expected += 1;
+                if constexpr (!SPIN)
+                    token.notify_one();
+                await_change(expected);
+            }
+            uint64_t t1 = bench::now_ns();
+            partner.join();
+            return (double)(t1 - t0) / rounds;
+        }
+        
+        define_benchmark("atomic_wake_latency") {
+            long rounds = 20000;
+            bench::emit("atomic_wake_latency", "wait32", 2, rounds, ping_pong_ns_per_round_trip<uint32_t, false>(rounds));
+            bench::emit("atomic_wake_latency", "wait64", 2, rounds, ping_pong_ns_per_round_trip<uint64_t, false>(rounds));
+            // spinning partners on a single core only progress when preempted
+            if (std::thread::hardware_concurrency() < 2) {
+                fprintf(stderr, "atomic_wake_latency: skipping spin variants on one core\n");
+                return;
+            }
+            bench::emit("atomic_wake_latency", "spin32", 2, rounds, ping_pong_ns_per_round_trip<uint32_t, true>(rounds));
+            bench::emit("atomic_wake_latency", "spin64", 2, rounds, ping_pong_ns_per_round_trip<uint64_t, true>(rounds));
+        };
+        
+        // Timed waits that expire measure the deadline path and its overshoot
+        
+        define_benchmark("atomic_wait_until_overshoot") {
+            long rounds = 100;
+            uint64_t timeout_ns = 100000;
+            Atomic<uint64_t> token{0};
+            uint64_t overshoot = 0;
+            for (long i = 0; i != rounds; ++i) {
+                uint64_t expected = 0;
+                uint64_t deadline = atomic_wait_clock_now() + timeout_ns;
+                AtomicWaitResult result = token.wait_until(expected, Ordering::RELAXED, deadline);
+                uint64_t t = atomic_wait_clock_now();
+                if (result != AtomicWaitResult::TIMEOUT || t < deadline)
+                    abort();
+                overshoot += t - deadline;
+            }
+            bench::emit("atomic_wait_until_overshoot", "wait64", 1, rounds, (double)overshoot / rounds);
+        };
+        
+    } // namespace
+    
+} // namespace aaa
@@ -0,0 +1,104 @@
+//
+//  bench_gc.cpp
+//  aaa
+//
+//  Created by Antony Searle on 24/1/2025.
+//
+
+#include <cstdint>
+#include <cstdio>
+
+#include <algorithm>
+#include <limits>
+#include <random>
+#include <vector>
+
+#include "bench.hpp"
+#include "gc.hpp"
+#include "object.hpp"
+
+namespace aaa {
+    
+    namespace {
+        
+        // A synthetic heap: a four-way tree, so that there is parallelism to
+        // find, with an extra edge from each node to a random other node, so
+        // that markers race to trace shared objects
+        
+        struct SyntheticNode : gc::Object {
+            
+            const SyntheticNode* children[5] = {};
+            
+            virtual void _object_scan() const override {
+                for (const SyntheticNode* child : children)
+                    gc::object_trace(child);
+            }
+            
+        };
+        
+        std::vector<SyntheticNode*> synthetic_heap(long n) {
+            std::vector<SyntheticNode*> nodes(n);
+            for (SyntheticNode*& p : nodes)
+                p = new SyntheticNode;
+            std::mt19937_64 generator{(uint64_t)n};
+            for (long i = 0; i != n; ++i) {
+                for (long j = 0; j != 4; ++j)
+                    if (4 * i + j + 1 < n)
+                        nodes[i]->children[j] = nodes[4 * i + j + 1];
+                nodes[i]->children[4] = nodes[generator() % n];
+            }
+            return nodes;
+        }
+        
+        // The collector never sees these objects in a cycle while the main
+        // thread, which allocated them, has not handshaken, so we can
+        // recolor them at will
+        void whiten(const std::vector<SyntheticNode*>& nodes) {
+            for (SyntheticNode* p : nodes) {
+                gc::Color expected = p->color.load();
+                (void) p->color.compare_exchange(expected, gc::Color::WHITE);
+            }
+        }
+        
+        define_benchmark("gc_mark") {
+            for (long n : bench::options.sizes) {
+                std::vector<SyntheticNode*> nodes = synthetic_heap(n);
+                const gc::Object* root = nodes[0];
+                for (long threads : bench::options.threads) {
+                    uint64_t best = std::numeric_limits<uint64_t>::max();
+                    for (long i = 0; i != bench::options.repetitions; ++i) {
+                        whiten(nodes);
+                        uint64_t t0 = bench::now_ns();
+                        size_t scanned = gc::trace(&root, &root + 1, (int)threads);
+                        uint64_t t1 = bench::now_ns();
+                        if (scanned != (size_t)n)
+                            fprintf(stderr, "gc_mark: scanned %zu of %ld\n", scanned, n);
+                        best = std::min(best, t1 - t0);
+                    }
+                    bench::emit("gc_mark", "work_stealing", threads, n, (double)best / n);
+                }
+            }
+        };
+        
+        struct SmallObject : gc::Object {
+            uint64_t payload[2] = {};
+            virtual void _object_scan() const override {}
+        };
+        
+        // Allocating garbage between handshakes, which hand the allocations
+        // to the collector, and let it delete them
+        
+        define_benchmark("gc_allocate") {
+            for (long n : bench::options.sizes) {
+                double ns = bench::best_of([n]() {
+                    for (long i = 0; i != n; ++i)
+                        (void) new SmallObject;
+                    gc::mutator_handshake();
+                });
+                bench::emit("gc_allocate", "page_log", 1, n, ns / n);
+            }
+        };
+        
+    } // namespace
+    
+} // namespace aaa
@@ -0,0 +1,86 @@
+//
+//  bench_main.cpp
+//  aaa
+//
+//  Created by Antony Searle on 22/1/2025.
+//
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+#include "allocator.hpp"
+#include "bench.hpp"
+#include "gc.hpp"
+#include "skiplist.hpp"
+
+// usage: aaa_bench [--sizes=N,...] [--threads=N,...] [--repetitions=N] [name...]
+//
+// Runs the named benchmarks, or all of them if none are named, and prints one
+// JSON object per line per result
+
+namespace {
+    
+    std::vector<long> parse_list(const char* text) {
+        std::vector<long> result;
+        while (*text) {
+            char* end = nullptr;
+            long value = strtol(text, &end, 0);
+            if (end == text) {
+                fprintf(stderr, "aaa_bench: bad list \"%s\"\n", text);
+                exit(EXIT_FAILURE);
+            }
+            result.push_back(value);
+            text = (*end == ',') ? end + 1 : end;
+        }
+        return result;
+    }
+    
+} // namespace
+
+int main(int argc, char** argv) {
+    
+    using namespace aaa;
+    
+    std::vector<const char*> names;
+    for (int i = 1; i != argc; ++i) {
+        if (!strncmp(argv[i], "--sizes=", 8)) {
+            bench::options.sizes = parse_list(argv[i] + 8);
+        } else if (!strncmp(argv[i], "--threads=", 10)) {
+            bench::options.threads = parse_list(argv[i] + 10);
+        } else if (!strncmp(argv[i], "--repetitions=", 14)) {
+            bench::options.repetitions = strtol(argv[i] + 14, nullptr, 0);
+        } else {
+            names.push_back(argv[i]);
+        }
+    }
+    
+    // start the garbage collector thread
+    gc::collector_start();
+    
+    arena_initialize(); // thread-local bump allocator
+    thread_local_random_number_generator = new std::ranlux24_base;
+    
+    // get permission to start allocating gc::Objects
+    gc::mutator_enter();
+    
+    for (bench::Benchmark* p = bench::registry_head; p; p = p->next) {
+        bool selected = names.empty();
+        for (const char* name : names)
+            selected = selected || !strcmp(name, p->name);
+        if (selected) {
+            fprintf(stderr, "running %s\n", p->name);
+            p->function();
+            // Answer the collector, which cannot finish a cycle until we do
+            gc::mutator_handshake();
+        }
+    }
+    
+    gc::mutator_leave();
+    arena_finalize();
+    
+    gc::collector_stop();
+    
+}
@@ -0,0 +1,207 @@
+//
+//  bench_parallel_algorithms.cpp
+//  aaa
+//
+//  Created by Antony Searle on 22/1/2025.
+//
+
+#include <cstdio>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "bench.hpp"
+#include "parallel_algorithms.hpp"
+#include "thread_pool.hpp"
+
+namespace aaa {
+    
+    namespace {
+        
+        // Keys are drawn from a range this many times larger than the number
+        // of elements, as in the original test
+        constexpr uint64_t SPARSITY = 100;
+        
+        std::vector<uint64_t> random_keys(long count, uint64_t seed) {
+            std::mt19937_64 prng{seed};
+            std::uniform_int_distribution<uint64_t> p{0, count * SPARSITY - 1};
+            std::vector<uint64_t> keys(count);
+            for (uint64_t& key : keys)
+                key = p(prng);
+            return keys;
+        }
+        
+        PersistentIntMap<uint64_t> random_map(long count, uint64_t seed) {
+            PersistentIntMap<uint64_t> a;
+            for (uint64_t key : random_keys(count, seed))
+                a.insert_or_replace(key, key);
+            return a;
+        }
+        
+        latch::signalling_coroutine
+        emplace_keys(latch&,
+                     concurrent_skiplist_map<uint64_t, uint64_t>& z,
+                     const uint64_t* first,
+                     const uint64_t* last) {
+            for (; first != last; ++first)
+                z.emplace(*first, *first);
+            co_return;
+        }
+        
+        frozen_skiplist_map<uint64_t, uint64_t> random_skiplist(long count, uint64_t seed) {
+            concurrent_skiplist_map<uint64_t, uint64_t> z;
+            for (uint64_t key : random_keys(count, seed))
+                z.emplace(key, key);
+            return std::move(z).freeze();
+        }
+        
+        // Runs f(pool, threads) for each requested thread count with a pool of that
+        // many workers
+        template<typename F>
+        void for_each_pool(F&& f) {
+            for (long threads : bench::options.threads) {
+                if (threads < 1) {
+                    fprintf(stderr, "skipping unsupported thread count %ld\n", threads);
+                    continue;
+                }
+                thread_pool pool{(int)threads};
+                f(pool, threads);
+            }
+        }
+        
+        define_benchmark("merge_left") {
+            for (long n : bench::options.sizes) {
+                PersistentIntMap<uint64_t> a = random_map(n, 1);
+                PersistentIntMap<uint64_t> b = random_map(n, 2);
+                double t = bench::best_of([&]() {
+                    (void) merge_left(a, b);
+                });
+                bench::emit("merge_left", "serial", 1, n, t / n);
+            }
+        };
+        
+        // the same merge as latch-counted coroutines, spawning everything or
+        // with the default policy, and as fork/join
+        define_benchmark("parallel_merge_left") {
+            for_each_pool([](thread_pool& pool, long threads) {
+                for (long n : bench::options.sizes) {
+                    PersistentIntMap<uint64_t> a = random_map(n, 1);
+                    PersistentIntMap<uint64_t> b = random_map(n, 2);
+                    for (auto [variant, policy] : {std::pair{"spawn", execution_policy::spawn()},
+                                                   std::pair{"inline", execution_policy{.serial_shift = -1}},
+                                                   std::pair{"grain6", execution_policy{.serial_shift = 6}}}) {
+                        double t = bench::best_of([&]() {
+                            PersistentIntMap<uint64_t> c;
+                            pool.block_on([&](latch& inner) {
+                                parallel_merge_left<uint64_t>(inner, a._root, b._root, &c._root, policy);
+                            });
+                        });
+                        bench::emit("parallel_merge_left", variant, threads, n, t / n);
+                    }
+                    double t = bench::best_of([&]() {
+                        PersistentIntMap<uint64_t> c;
+                        pool.block_on([&](latch& inner) {
+                            fork_root(inner, fork_merge_left<uint64_t>(a._root, b._root, &c._root));
+                        });
+                    });
+                    bench::emit("parallel_merge_left", "fork", threads, n, t / n);
+                }
+            });
+        };
+        
+        // Merging one leaf into a large map is a chain of single-child
+        // adoptions, which is all scheduling overhead unless inlined; the
+        // time is per merge
+        define_benchmark("parallel_merge_left_leaf") {
+            for_each_pool([](thread_pool& pool, long threads) {
+                for (long n : bench::options.sizes) {
+                    PersistentIntMap<uint64_t> a = random_map(n, 1);
+                    PersistentIntMap<uint64_t> b;
+                    uint64_t base = n * SPARSITY / 2 & ~(uint64_t)63;
+                    for (uint64_t key = base; key != base + 64; ++key)
+                        b.insert_or_replace(key, key);
+                    constexpr long MERGES = 100;
+                    for (auto [variant, policy] : {std::pair{"spawn", execution_policy::spawn()},
+                                                   std::pair{"inline", execution_policy{.serial_shift = -1}}}) {
+                        double t = bench::best_of([&]() {
+                            const PersistentIntMap<uint64_t>::Node* c[MERGES] = {};
+                            pool.block_on([&](latch& inner) {
+                                for (long i = 0; i != MERGES; ++i)
+                                    parallel_merge_left<uint64_t>(inner, a._root, b._root, c + i, policy);
+                            });
+                        });
+                        bench::emit("parallel_merge_left_leaf", variant, threads, n, t / MERGES);
+                    }
+                }
+            });
+        };
+        
+        define_benchmark("skiplist_emplace") {
+            for_each_pool([](thread_pool& pool, long threads) {
+                for (long n : bench::options.sizes) {
+                    std::vector<uint64_t> keys = random_keys(n, 3);
+                    double t = bench::best_of([&]() {
+                        concurrent_skiplist_map<uint64_t, uint64_t> z;
+                        pool.block_on([&](latch& inner) {
+                            for (long i = 0; i != threads; ++i)
+                                emplace_keys(inner,
+                                             z,
+                                             keys.data() + n * i / threads,
+                                             keys.data() + n * (i + 1) / threads);
+                        });
+                    });
+                    bench::emit("skiplist_emplace", "concurrent", threads, n, t / n);
+                }
+            });
+        };
+        
+        define_benchmark("parallel_merge_right") {
+            for_each_pool([](thread_pool& pool, long threads) {
+                for (long n : bench::options.sizes) {
+                    PersistentIntMap<uint64_t> a = random_map(n, 4);
+                    frozen_skiplist_map<uint64_t, uint64_t> b = random_skiplist(n, 5);
+                    for (auto [variant, policy] : {std::pair{"spawn", execution_policy::spawn()},
+                                                   std::pair{"inline", execution_policy{.serial_shift = -1}},
+                                                   std::pair{"grain6", execution_policy{.serial_shift = 6}},
+                                                   std::pair{"grain12", execution_policy{.serial_shift = 12}}}) {
+                        double t = bench::best_of([&]() {
+                            PersistentIntMap<uint64_t> c;
+                            pool.block_on([&](latch& inner) {
+                                parallel_merge_right<uint64_t>(inner, a, b, c, policy);
+                            });
+                        });
+                        bench::emit("parallel_merge_right", variant, threads, n, t / n);
+                    }
+                }
+            });
+        };
+        
+        define_benchmark("parallel_persist_generate") {
+            for_each_pool([](thread_pool& pool, long threads) {
+                for (long n : bench::options.sizes) {
+                    auto f = [](uint64_t key) { return key; };
+                    for (auto [variant, policy] : {std::pair{"latch", execution_policy{.serial_shift = -1}},
+                                                   std::pair{"grain6", execution_policy{.serial_shift = 6}},
+                                                   std::pair{"grain12", execution_policy{.serial_shift = 12}}}) {
+                        double t = bench::best_of([&]() {
+                            PersistentIntMap<uint64_t> a;
+                            pool.block_on([&](latch& inner) {
+                                parallel_persist_generate_outer<uint64_t>(inner, &a, 0, n - 1, f, policy);
+                            });
+                        });
+                        bench::emit("parallel_persist_generate", variant, threads, n, t / n);
+                    }
+                    double t = bench::best_of([&]() {
+                        PersistentIntMap<uint64_t> a;
+                        pool.block_on([&](latch& inner) {
+                            fork_root(inner, fork_persist_generate<uint64_t>(&a._root, 0, n - 1, f));
+                        });
+                    });
+                    bench::emit("parallel_persist_generate", "fork", threads, n, t / n);
+                }
+            });
+        };
+        
+    } // namespace
+    
+} // namespace aaa
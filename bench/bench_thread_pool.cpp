@@ -0,0 +1,101 @@
+//
+//  bench_thread_pool.cpp
+//  aaa
+//
+//  Created by Antony Searle on 22/1/2025.
+//
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#include "atomic.hpp"
+#include "awaitable.hpp"
+#include "bench.hpp"
+#include "latch.hpp"
+#include "thread_pool.hpp"
+
+namespace aaa {
+    
+    namespace {
+        
+        co_void record_resume(Atomic<uint64_t>& resumed) {
+            resumed.store(bench::now_ns(), Ordering::RELEASE);
+            resumed.notify_all();
+            co_return;
+        }
+        
+        // The owning thread schedules a coroutine on a pool whose workers
+        // have all gone to sleep, and measures how long it takes one of them
+        // to wake up, steal it, and resume it.  This is the latency a frame
+        // pays to get the pool going again after an idle period.
+        
+        define_benchmark("pool_push_to_resume") {
+            long rounds = 200;
+            for (long threads : bench::options.threads) {
+                if (threads < 1)
+                    continue;
+                thread_pool pool{(int)threads};
+                std::vector<uint64_t> samples;
+                for (long i = 0; i != rounds; ++i) {
+                    // let the workers exhaust their spinning and sleep
+                    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                    Atomic<uint64_t> resumed{0};
+                    uint64_t t0 = bench::now_ns();
+                    record_resume(resumed);
+                    uint64_t t1 = 0;
+                    while (!t1)
+                        resumed.wait(t1, Ordering::ACQUIRE);
+                    samples.push_back(t1 - t0);
+                }
+                std::sort(samples.begin(), samples.end());
+                bench::emit("pool_push_to_resume", "idle_median", threads, rounds, (double)samples[rounds / 2]);
+                bench::emit("pool_push_to_resume", "idle_p99", threads, rounds, (double)samples[rounds * 99 / 100]);
+            }
+        };
+        
+        latch::signalling_coroutine noop(latch& outer) {
+            co_return;
+        }
+        
+        latch::signalling_coroutine burst(latch& outer, long count) {
+            latch inner;
+            for (long i = 0; i != count; ++i)
+                noop(inner);
+            co_await inner;
+        }
+        
+        // A frame of size coroutines, with and without the consensus that
+        // rewinds every arena afterwards.  Without it the workers' arenas
+        // grow without bound, and every slab they outgrow is a fresh
+        // malloc and page faults
+        
+        define_benchmark("pool_end_frame") {
+            long frames = 64;
+            for (long threads : bench::options.threads) {
+                if (threads < 1)
+                    continue;
+                thread_pool pool{(int)threads};
+                for (long size : bench::options.sizes) {
+                    for (bool end : { false, true }) {
+                        double ns = bench::best_of([&]() {
+                            for (long i = 0; i != frames; ++i) {
+                                pool.block_on([&](latch& inner) {
+                                    burst(inner, size);
+                                });
+                                if (end)
+                                    pool.end_frame();
+                            }
+                        });
+                        // leave the next variant a clean slate
+                        pool.end_frame();
+                        bench::emit("pool_end_frame", end ? "end_frame" : "block_on", threads, size, ns / frames);
+                    }
+                }
+            }
+        };
+        
+    } // namespace
+    
+} // namespace aaa
@@ -0,0 +1,141 @@
+//
+//  bench_work_stealing_deque.cpp
+//  aaa
+//
+//  Created by Antony Searle on 22/1/2025.
+//
+
+#include <cstdint>
+
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "allocator.hpp"
+#include "atomic.hpp"
+#include "bench.hpp"
+#include "gc.hpp"
+#include "work_stealing_deque.hpp"
+
+namespace aaa {
+    
+    namespace {
+        
+        using deque_type = work_stealing_deque<intptr_t>;
+        using bounded_deque_type = bounded_work_stealing_deque<intptr_t, 256>;
+        
+        // One owner fills its deque, then thieves drain it as fast as they
+        // can, as at the start of a wide fan-out.  With steal_half each
+        // thief moves a batch into its own deque and pops from there, so
+        // the victim's _top sees one CAS per batch instead of per item.
+        
+        template<typename Deque, bool HALF>
+        double drain_ns_per_item(long thieves, long count) {
+            Deque victim;
+            for (long i = 0; i != count; ++i)
+                victim.push((intptr_t)i);
+            Atomic<uint32_t> go{0};
+            Atomic<long> ready{0};
+            Atomic<long> consumed{0};
+            std::vector<std::thread> threads;
+            for (long t = 0; t != thieves; ++t) {
+                threads.emplace_back([&]() {
+                    arena_initialize();
+                    gc::mutator_enter();
+                    {
+                        // the thief's own deque allocates gc::Objects
+                        std::unique_ptr<Deque> own{new Deque};
+                        ready.add_fetch(1, Ordering::RELEASE);
+                        uint32_t expected = 0;
+                        while (!expected)
+                            go.wait(expected, Ordering::ACQUIRE);
+                        long n = 0;
+                        intptr_t item = 0;
+                        for (;;) {
+                            if (own->pop(item)) {
+                                ++n;
+                                continue;
+                            }
+                            bool stolen = false;
+                            if constexpr (HALF)
+                                stolen = victim.steal_half(item, *own);
+                            else
+                                stolen = victim.steal(item);
+                            if (stolen) {
+                                ++n;
+                                continue;
+                            }
+                            if (!victim.can_steal())
+                                break;
+                        }
+                        consumed.add_fetch(n, Ordering::RELAXED);
+                    }
+                    gc::mutator_exit();
+                    arena_finalize();
+                });
+            }
+            while (ready.load(Ordering::ACQUIRE) != thieves)
+                std::this_thread::yield();
+            uint64_t t0 = bench::now_ns();
+            go.store(1, Ordering::RELEASE);
+            go.notify_all();
+            for (auto& t : threads)
+                t.join();
+            uint64_t t1 = bench::now_ns();
+            if (consumed.load(Ordering::RELAXED) != count)
+                fprintf(stderr, "work_stealing_deque_drain: lost items\n");
+            return (double)(t1 - t0) / count;
+        }
+        
+        define_benchmark("work_stealing_deque_drain") {
+            // wide pools, whatever --threads says
+            for (long thieves : { 8, 32, 128 }) {
+                for (long n : bench::options.sizes) {
+                    double best[4] = { 1e300, 1e300, 1e300, 1e300 };
+                    for (long r = 0; r != bench::options.repetitions; ++r) {
+                        best[0] = std::min(best[0], drain_ns_per_item<deque_type, false>(thieves, n));
+                        best[1] = std::min(best[1], drain_ns_per_item<deque_type, true>(thieves, n));
+                        best[2] = std::min(best[2], drain_ns_per_item<bounded_deque_type, false>(thieves, n));
+                        best[3] = std::min(best[3], drain_ns_per_item<bounded_deque_type, true>(thieves, n));
+                    }
+                    bench::emit("work_stealing_deque_drain", "steal", thieves, n, best[0]);
+                    bench::emit("work_stealing_deque_drain", "steal_half", thieves, n, best[1]);
+                    bench::emit("work_stealing_deque_drain", "bounded_steal", thieves, n, best[2]);
+                    bench::emit("work_stealing_deque_drain", "bounded_steal_half", thieves, n, best[3]);
+                }
+            }
+        };
+        
+        // The owner's own traffic, with no thieves: bursts of pushes then
+        // pops, as a worker recursing depth-first does.  Bursts within the
+        // bounded deque's capacity never touch its overflow.
+        
+        template<typename Deque>
+        double push_pop_ns_per_item(long burst, long count) {
+            Deque a;
+            intptr_t item = 0;
+            intptr_t sum = 0;
+            double t = bench::best_of([&]() {
+                for (long i = 0; i != count; i += burst) {
+                    for (long j = 0; j != burst; ++j)
+                        a.push((intptr_t)j);
+                    while (a.pop(item))
+                        sum += item;
+                }
+            });
+            if (sum == -1)
+                fprintf(stderr, "unreachable\n");
+            return t / count;
+        }
+        
+        define_benchmark("work_stealing_deque_push_pop") {
+            long count = 1 << 20;
+            for (long burst : { 16, 64, 1024 }) {
+                bench::emit("work_stealing_deque_push_pop", "unbounded", 1, burst, push_pop_ns_per_item<deque_type>(burst, count));
+                bench::emit("work_stealing_deque_push_pop", "bounded", 1, burst, push_pop_ns_per_item<bounded_deque_type>(burst, count));
+            }
+        };
+        
+    } // namespace
+    
+} // namespace aaa
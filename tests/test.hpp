@@ -0,0 +1,64 @@
+//
+//  test.hpp
+//  aaa
+//
+//  Created by Antony Searle on 22/1/2025.
+//
+
+#ifndef test_hpp
+#define test_hpp
+
+namespace aaa {
+    struct thread_pool;
+}
+
+namespace aaa::test {
+    
+    // Minimal test registry
+    //
+    //     define_test("name") {
+    //         assert(...);
+    //     };
+    //
+    // The build compiles tests without NDEBUG so assertions are always
+    // checked.
+    //
+    // Tests run on the main thread, which is a gc mutator with an arena, and
+    // may use the thread pool via test::pool->block_on
+    
+    struct Test {
+        
+        const char* name;
+        void (*function)();
+        Test* next;
+        
+        explicit Test(const char* name)
+        : name(name)
+        , function(nullptr)
+        , next(nullptr) {
+        }
+        
+    };
+    
+    inline Test* registry_head = nullptr;
+    
+    // The pool the tests run on, owned by main
+    inline thread_pool* pool = nullptr;
+    
+    inline Test& operator+(Test&& test, void (*function)()) {
+        Test* node = new Test(test);
+        node->function = function;
+        node->next = registry_head;
+        registry_head = node;
+        return *node;
+    }
+    
+} // namespace aaa::test
+
+#define AAA_TEST_CONCATENATE2(X, Y) X##Y
+#define AAA_TEST_CONCATENATE(X, Y) AAA_TEST_CONCATENATE2(X, Y)
+
+#define define_test(NAME) \
+[[maybe_unused]] static ::aaa::test::Test& AAA_TEST_CONCATENATE(_test_, __LINE__) = ::aaa::test::Test(NAME) + []
+
+#endif /* test_hpp */
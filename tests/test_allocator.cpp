@@ -0,0 +1,302 @@
+//
+//  test_allocator.cpp
+//  aaa
+//
+//  Created by Antony Searle on 24/1/2025.
+//
+
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+
+#include <memory_resource>
+#include <thread>
+#include <vector>
+
+#include "allocator.hpp"
+#include "concurrent_deque.hpp"
+#include "gc.hpp"
+#include "latch.hpp"
+#include "test.hpp"
+#include "thread_pool.hpp"
+
+namespace aaa {
+    
+    namespace {
+        
+        latch::signalling_coroutine noop(latch& outer) {
+            co_return;
+        }
+        
+        latch::signalling_coroutine spawn_many(latch& outer, long count) {
+            latch inner;
+            for (long i = 0; i != count; ++i)
+                noop(inner);
+            co_await inner;
+        }
+        
+    } // namespace
+    
+    define_test("arena") {
+        
+        // on a thread of its own, so that we may rewind its arena
+        std::thread([]() {
+            arena_initialize();
+            
+            // aligned allocations are aligned, whatever came before
+            for (size_t alignment = 1; alignment != 512; alignment <<= 1) {
+                (void) arena_allocate(3);
+                void* p = arena_allocate_aligned(40, alignment);
+                assert(((uintptr_t)p & (alignment - 1)) == 0);
+                std::memset(p, 0xCD, 40);
+            }
+            
+            // requests too big for the slab get their own, and the current
+            // slab carries on where it left off
+            {
+                _arena_t* top = _tl_arena;
+                unsigned char* begin = top->begin;
+                for (size_t n : { (size_t)1 << 21, (size_t)1 << 26 }) {
+                    void* p = arena_allocate_aligned(n, 128);
+                    assert(((uintptr_t)p & 127) == 0);
+                    std::memset(p, 0xCD, n);
+                    assert(_tl_arena == top);
+                    assert(top->begin == begin);
+                }
+                assert(arena_reserved() > ((size_t)1 << 26));
+            }
+            
+            // growth preserves alignment
+            for (int i = 0; i != 100; ++i) {
+                void* p = arena_allocate_aligned(100000, 64);
+                assert(((uintptr_t)p & 63) == 0);
+                std::memset(p, 0xCD, 100000);
+            }
+            
+            // a recycled block is reused by the next request of its size
+            // class, and by nothing else
+            {
+                void* a = arena_allocate_recyclable(100);
+                assert(((uintptr_t)a & (ARENA_GRANULE - 1)) == 0);
+                arena_recycle(a, 100);
+                void* b = arena_allocate_recyclable(200);
+                assert(b != a);
+                void* c = arena_allocate_recyclable(112);
+                assert(c == a);
+                void* d = arena_allocate_recyclable(100);
+                assert(d != a);
+                // too big to be recycled
+                void* e = arena_allocate_recyclable(4096);
+                arena_recycle(e, 4096);
+                assert(arena_allocate_recyclable(4096) != e);
+            }
+            
+            // rewinding forgets the free lists and keeps only the newest
+            // slab
+            {
+                void* a = arena_allocate_recyclable(64);
+                arena_recycle(a, 64);
+                arena_advance();
+                assert(_tl_arena_free[_arena_size_class(64)] == nullptr);
+                assert(_tl_arena->predecessor == nullptr);
+                assert(arena_reserved() == (size_t)(_tl_arena->end - (unsigned char*)_tl_arena));
+            }
+            
+            arena_finalize();
+        }).join();
+        
+    };
+    
+    define_test("arena_pool") {
+        
+        auto grow = []() {
+            for (int i = 0; i != 64; ++i)
+                std::memset(arena_allocate_aligned(100000, 16), 0xCD, 100000);
+        };
+        
+        // a thread outgrows a few slabs, and retires them all on exit
+        std::thread([&]() {
+            arena_initialize();
+            grow();
+            assert(_tl_arena->predecessor);
+            arena_advance();
+            arena_finalize();
+        }).join();
+        
+        // the next thread to do the same draws every slab it needs back
+        arena_pool_statistics before = arena_pool_stats();
+        std::thread([&]() {
+            arena_initialize();
+            grow();
+            arena_finalize();
+        }).join();
+        arena_pool_statistics after = arena_pool_stats();
+        assert(after.misses == before.misses);
+        assert(after.hits > before.hits);
+        
+        // slabs left in the pool are advised once they go unused, and are
+        // still good afterwards
+        arena_pool_tick(0);
+        arena_pool_tick(0);
+        assert(arena_pool_stats().advised > after.advised);
+        std::thread([&]() {
+            arena_initialize();
+            grow();
+            arena_finalize();
+        }).join();
+        
+    };
+    
+    define_test("arena_backing") {
+        
+        for (arena_options options : {
+            arena_options{.huge_pages = true},
+            arena_options{.numa_node = 0},
+            arena_options{.huge_pages = true, .numa_node = 0},
+        }) {
+            std::thread([&]() {
+                arena_initialize(options);
+#if defined(__linux__)
+                // mapped in whole huge pages, whether or not we got them
+                if (options.huge_pages)
+                    assert(arena_reserved() % (2 << 20) == 0);
+#endif
+                for (int i = 0; i != 64; ++i) {
+                    void* p = arena_allocate_aligned(100000, 64);
+                    assert(((uintptr_t)p & 63) == 0);
+                    std::memset(p, 0xCD, 100000);
+                }
+                arena_advance();
+                arena_finalize();
+            }).join();
+        }
+        
+        // and configured per pool
+        std::thread([]() {
+            arena_initialize();
+            gc::mutator_enter();
+            {
+                thread_pool pool{thread_pool_options{
+                    .worker_count = 2,
+                    .pin_workers = true,
+                    .huge_page_arenas = true,
+                    .numa_local_arenas = true,
+                }};
+                for (int i = 0; i != 4; ++i) {
+                    pool.block_on([](latch& inner) {
+                        spawn_many(inner, 1 << 14);
+                    });
+                    pool.end_frame();
+                }
+            }
+            gc::mutator_exit();
+            arena_finalize();
+        }).join();
+        
+    };
+    
+    define_test("arena_statistics") {
+        
+        arena_statistics before = arena_stats_total();
+        std::thread([&]() {
+            arena_initialize();
+            arena_statistics a = arena_stats();
+            assert(a.bytes_bumped == 0 && a.frames == 0);
+            assert(a.reserved_bytes == arena_reserved());
+            
+            // a frame of 3 MiB in 16 KiB pieces outgrows the initial slab
+            // twice, and one big request gets a slab of its own
+            for (int i = 0; i != 192; ++i)
+                (void) arena_allocate(1 << 14);
+            (void) arena_allocate(1 << 23);
+            a = arena_stats();
+            assert(a.growths == 2);
+            assert(a.oversized == 1);
+            assert(a.largest_request == (1 << 23));
+            assert(a.reserved_bytes == arena_reserved());
+            arena_advance();
+            a = arena_stats();
+            assert(a.frames == 1);
+            assert(a.bytes_bumped == (192 << 14) + (1 << 23));
+            assert(a.last_frame_bytes == a.bytes_bumped);
+            assert(a.frame_high_water == a.bytes_bumped);
+            assert(a.wasted_tail_bytes < (2 << 14));
+            assert(a.reserved_bytes == arena_reserved());
+            
+            // a smaller frame leaves the high water mark where it was
+            for (int i = 0; i != 16; ++i)
+                (void) arena_allocate(1 << 14);
+            arena_advance();
+            arena_statistics b = arena_stats();
+            assert(b.frames == 2);
+            assert(b.last_frame_bytes == (16 << 14));
+            assert(b.frame_high_water == a.frame_high_water);
+            
+            // visible to the other threads
+            bool found = false;
+            for (const arena_statistics& c : arena_stats_per_thread())
+                found = found || (c.bytes_bumped == b.bytes_bumped && c.frames == 2);
+            assert(found);
+            
+            arena_finalize();
+        }).join();
+        arena_statistics after = arena_stats_total();
+        assert(after.bytes_bumped - before.bytes_bumped >= (208 << 14) + (1 << 23));
+        assert(after.frame_high_water >= (192 << 14) + (1 << 23));
+        
+    };
+    
+    define_test("bump_allocator") {
+        
+        BumpAllocator* a = nullptr;
+        
+        // allocations bump downwards, aligned, and chain new slabs as needed
+        {
+            intptr_t previous = INTPTR_MAX;
+            for (size_t alignment = 1; alignment != 512; alignment <<= 1) {
+                void* p = bump_allocator_aligned_alloc(a, alignment, 40);
+                assert(((uintptr_t)p & (alignment - 1)) == 0);
+                assert((intptr_t)p + 40 <= previous);
+                previous = (intptr_t)p;
+                std::memset(p, 0xCD, 40);
+            }
+            BumpAllocator* first = a;
+            assert(first && !first->predecessor);
+            void* p = bump_allocator_aligned_alloc(a, 64, BUMP_ALLOCATOR_INITIAL_SIZE * 5);
+            assert(((uintptr_t)p & 63) == 0);
+            std::memset(p, 0xCD, BUMP_ALLOCATOR_INITIAL_SIZE * 5);
+            assert(a != first && a->predecessor == first);
+            assert(a->size >= BUMP_ALLOCATOR_INITIAL_SIZE * 5);
+        }
+        
+        // reset keeps the newest slab and starts again from its top
+        {
+            BumpAllocator* newest = a;
+            bump_allocator_reset(a);
+            assert(a == newest && !a->predecessor);
+            void* p = bump_allocator_aligned_alloc(a, 16, 16);
+            assert((intptr_t)p == (intptr_t)a + (intptr_t)a->size - 16);
+            bump_allocator_release(a);
+            assert(!a);
+        }
+        
+        // std::pmr containers
+        {
+            bump_memory_resource resource;
+            std::pmr::vector<int> v{&resource};
+            for (int i = 0; i != 100000; ++i)
+                v.push_back(i);
+            for (int i = 0; i != 100000; ++i)
+                assert(v[i] == i);
+            concurrent_deque_stl<int, std::pmr::polymorphic_allocator<int>> q{&resource};
+            for (int i = 0; i != 1000; ++i)
+                q.emplace(i);
+            int item = -1;
+            for (int i = 0; i != 1000; ++i)
+                assert(q.try_pop_stong(item) && (item == i));
+            assert(!q.try_pop_stong(item));
+        }
+        
+    };
+    
+} // namespace aaa
@@ -0,0 +1,71 @@
+//
+//  test_fork.cpp
+//  aaa
+//
+//  Created by Antony Searle on 19/1/2025.
+//
+
+#include <cassert>
+
+#include "fork.hpp"
+#include "test.hpp"
+#include "thread_pool.hpp"
+
+namespace aaa {
+    
+    namespace {
+        
+        fork_task fib(int n, long* result) {
+            if (n < 2) {
+                *result = n;
+                co_return;
+            }
+            long a = 0;
+            long b = 0;
+            co_await co_fork{fib(n - 1, &a)};
+            co_await co_fork{fib(n - 2, &b)};
+            co_await co_join{};
+            *result = a + b;
+        }
+        
+        // a wide fan-out with a call mixed in and two joins per task
+        fork_task fan(int depth, long* result) {
+            if (!depth) {
+                *result = 1;
+                co_return;
+            }
+            long partial[16] = {};
+            for (int i = 0; i != 8; ++i)
+                co_await co_fork{fan(depth - 1, partial + i)};
+            co_await co_join{};
+            co_await fan(depth - 1, partial + 8);
+            for (int i = 9; i != 16; ++i)
+                co_await co_fork{fan(depth - 1, partial + i)};
+            co_await co_join{};
+            long sum = 0;
+            for (long x : partial)
+                sum += x;
+            *result = sum;
+        }
+        
+    } // namespace
+    
+    define_test("fork_join") {
+        
+        for (int i = 0; i != 10; ++i) {
+            long result = -1;
+            test::pool->block_on([&](latch& inner) {
+                fork_root(inner, fib(24, &result));
+            });
+            assert(result == 46368);
+        }
+        
+        long result = -1;
+        test::pool->block_on([&](latch& inner) {
+            fork_root(inner, fan(5, &result));
+        });
+        assert(result == 16 * 16 * 16 * 16 * 16);
+        
+    };
+    
+} // namespace aaa
@@ -0,0 +1,363 @@
+//
+//  test_gc.cpp
+//  aaa
+//
+//  Created by Antony Searle on 24/1/2025.
+//
+
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+
+#include <chrono>
+#include <random>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "gc.hpp"
+#include "heap.hpp"
+#include "object.hpp"
+#include "test.hpp"
+
+namespace aaa {
+    
+    namespace {
+        
+        struct TestObject : gc::Object {
+            uint64_t payload[3] = {};
+            virtual void _object_scan() const override {}
+        };
+        
+        struct TestNode : gc::Object {
+            const TestNode* children[3] = {};
+            virtual void _object_scan() const override {
+                for (const TestNode* child : children)
+                    gc::object_trace(child);
+            }
+        };
+        
+        // Scans and deletions counted by tag
+        Atomic<size_t> counted_scanned[8];
+        Atomic<size_t> counted_destroyed[8];
+        
+        struct CountedNode : TestNode {
+            int tag;
+            explicit CountedNode(int tag) : tag(tag) {}
+            virtual ~CountedNode() override {
+                counted_destroyed[tag].add_fetch(1, Ordering::RELAXED);
+            }
+            virtual void _object_scan() const override {
+                counted_scanned[tag].add_fetch(1, Ordering::RELAXED);
+                TestNode::_object_scan();
+            }
+        };
+        
+        // Handshake, as the collector asks, until the predicate holds
+        template<typename F>
+        void handshake_until(const gc::Object* root, F&& predicate) {
+            auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(60);
+            while (!predicate()) {
+                assert(std::chrono::steady_clock::now() < deadline);
+                gc::mutator_handshake();
+                gc::object_shade(root);
+                // in lazy mode, allocation is what deletes the garbage
+                (void) new TestObject;
+                std::this_thread::yield();
+            }
+        }
+        
+    } // namespace
+    
+    define_test("gc_colors") {
+        
+        using namespace gc;
+        
+        // Neighbours allocated together share a page, and changing the
+        // color of one leaves the others alone.  The collector owns the
+        // objects, so we leave them for it to sweep
+        constexpr int N = 64;
+        TestObject* objects[N];
+        for (TestObject*& p : objects)
+            p = new TestObject;
+        Color allocated = objects[0]->color.load();
+        assert((allocated == Color::WHITE) || (allocated == Color::BLACK));
+        for (TestObject* p : objects)
+            assert(p->color.load() == allocated);
+        for (int i = 0; i < N; i += 3) {
+            Color expected = allocated;
+            assert(objects[i]->color.compare_exchange(expected, Color::GRAY));
+            expected = allocated;
+            assert(!objects[i]->color.compare_exchange(expected, Color::RED));
+            assert(expected == Color::GRAY);
+        }
+        for (int i = 0; i != N; ++i)
+            assert(objects[i]->color.load() == ((i % 3) ? allocated : Color::GRAY));
+        for (int i = 0; i < N; i += 3) {
+            Color expected = Color::GRAY;
+            assert(objects[i]->color.compare_exchange(expected, allocated));
+        }
+
+#if AAA_GC_SIDE_TABLE_COLORS
+        // the colors live in the page, and not in the objects
+        static_assert(sizeof(TestObject) == 8 + sizeof(TestObject::payload));
+        _heap_page_t* page = _heap_page_of(objects[0]);
+        size_t slot = _heap_slot_of(page, objects[0]);
+        assert(_heap_slot_of(page, &objects[0]->payload[2]) == slot);
+        int shift = 0;
+        Atomic<uint64_t>& word = _heap_color_word(objects[0], shift);
+        assert(&word == &page->colors[slot >> 5]);
+        uint64_t before = word.load(Ordering::RELAXED);
+        Color expected = allocated;
+        assert(objects[0]->color.compare_exchange(expected, Color::GRAY));
+        assert((word.load(Ordering::RELAXED) ^ before) == ((uint64_t)(std::to_underlying(allocated) ^ std::to_underlying(Color::GRAY)) << shift));
+        expected = Color::GRAY;
+        assert(objects[0]->color.compare_exchange(expected, allocated));
+#endif
+        
+    };
+    
+    define_test("gc_trace") {
+        
+        using namespace gc;
+        
+        // A binary tree with an extra random edge per node into the first
+        // half, which is reachable, and a tail that nothing points to.  The
+        // collector never sees these objects in a cycle while the main
+        // thread, which allocated them, has not handshaken, so we can
+        // recolor them at will
+        constexpr size_t N = 1 << 14;
+        constexpr size_t REACHABLE = N / 2;
+        std::vector<TestNode*> nodes(N);
+        for (TestNode*& p : nodes)
+            p = new TestNode;
+        std::mt19937_64 generator;
+        for (size_t i = 0; i != REACHABLE; ++i) {
+            for (size_t j = 0; j != 2; ++j)
+                if (2 * i + j + 1 < REACHABLE)
+                    nodes[i]->children[j] = nodes[2 * i + j + 1];
+            nodes[i]->children[2] = nodes[generator() % REACHABLE];
+        }
+        for (size_t i = REACHABLE; i != N; ++i)
+            nodes[i]->children[0] = nodes[generator() % N];
+        const Object* root = nodes[0];
+        for (int marker_count : { 1, 2, 4 }) {
+            for (TestNode* p : nodes) {
+                Color expected = p->color.load();
+                (void) p->color.compare_exchange(expected, Color::WHITE);
+            }
+            // every reachable object is scanned exactly once
+            assert(trace(&root, &root + 1, marker_count) == REACHABLE);
+            for (size_t i = 0; i != N; ++i)
+                assert(nodes[i]->color.load() == ((i < REACHABLE) ? Color::BLACK : Color::WHITE));
+        }
+        
+    };
+    
+    define_test("gc_sweep") {
+        
+        using namespace gc;
+        
+        // Run real collections by handshaking, with the pool's workers
+        // asleep and so out of the collector's reckoning.  A rooted tree
+        // must survive them, and the garbage we make alongside it must be
+        // deleted, by the sweepers or, in lazy mode, by our allocations
+        for (bool lazy : { false, true }) {
+            collector_configure({.marker_count = 2, .lazy_sweep = lazy});
+            Atomic<size_t>& rooted_destroyed = counted_destroyed[lazy * 2];
+            Atomic<size_t>& garbage_destroyed = counted_destroyed[lazy * 2 + 1];
+            constexpr size_t ROOTED = 1 << 10;
+            constexpr size_t GARBAGE = 1 << 12;
+            std::vector<CountedNode*> rooted(ROOTED);
+            for (size_t i = 0; i != ROOTED; ++i) {
+                rooted[i] = new CountedNode(lazy * 2);
+                if (i)
+                    rooted[(i - 1) / 2]->children[(i - 1) % 2] = rooted[i];
+            }
+            const CountedNode* root = rooted[0];
+            for (size_t i = 0; i != GARBAGE; ++i) {
+                CountedNode* p = new CountedNode(lazy * 2 + 1);
+                // garbage may point into the rooted tree
+                p->children[0] = rooted[i % ROOTED];
+            }
+            handshake_until(root, [&]() {
+                return garbage_destroyed.load(Ordering::RELAXED) >= GARBAGE;
+            });
+            assert(garbage_destroyed.load(Ordering::RELAXED) == GARBAGE);
+            assert(rooted_destroyed.load(Ordering::RELAXED) == 0);
+            for (size_t i = 1; i != ROOTED; ++i)
+                assert(rooted[(i - 1) / 2]->children[(i - 1) % 2] == rooted[i]);
+            // leave the tree for a later cycle
+        }
+        collector_configure({});
+        
+    };
+    
+    define_test("gc_generations") {
+        
+        using namespace gc;
+        
+        // With minor cycles, a rooted tree is promoted by the first cycle it
+        // survives, and is never scanned again while the young garbage made
+        // around it comes and goes
+        collector_configure({.marker_count = 2, .minor_cycles = 1 << 20});
+        Atomic<size_t>& rooted_scanned = counted_scanned[4];
+        Atomic<size_t>& rooted_destroyed = counted_destroyed[4];
+        Atomic<size_t>& garbage_destroyed = counted_destroyed[5];
+        constexpr size_t ROOTED = 1 << 10;
+        constexpr size_t GARBAGE = 1 << 12;
+        std::vector<CountedNode*> rooted(ROOTED);
+        for (size_t i = 0; i != ROOTED; ++i) {
+            rooted[i] = new CountedNode(4);
+            if (i)
+                rooted[(i - 1) / 2]->children[(i - 1) % 2] = rooted[i];
+        }
+        const CountedNode* root = rooted[0];
+        size_t expected_destroyed = 0;
+        for (int batch = 0; batch != 4; ++batch) {
+            // Two batches see the options take effect and the tree promoted
+            if (batch == 2)
+                rooted_scanned.store(0, Ordering::RELAXED);
+            // We allocate BLACK from our first handshake of a cycle to our
+            // last, and the collector promotes those objects unexamined; wait
+            // until we are allocating young objects, as we will be until our
+            // next handshake
+            handshake_until(root, []() {
+                return (new TestObject)->color.load() == Color::WHITE;
+            });
+            const CountedNode* previous = nullptr;
+            for (size_t i = 0; i != GARBAGE; ++i) {
+                CountedNode* p = new CountedNode(5);
+                // young garbage may point into the old tree, and to other
+                // young garbage
+                p->children[0] = rooted[i % ROOTED];
+                p->children[1] = std::exchange(previous, p);
+            }
+            expected_destroyed += GARBAGE;
+            handshake_until(root, [&]() {
+                return garbage_destroyed.load(Ordering::RELAXED) >= expected_destroyed;
+            });
+            assert(garbage_destroyed.load(Ordering::RELAXED) == expected_destroyed);
+        }
+        assert(rooted_scanned.load(Ordering::RELAXED) == 0);
+        assert(rooted_destroyed.load(Ordering::RELAXED) == 0);
+        for (size_t i = 1; i != ROOTED; ++i)
+            assert(rooted[(i - 1) / 2]->children[(i - 1) % 2] == rooted[i]);
+        
+        // A whole-heap cycle still reclaims old objects once they die
+        collector_configure({.marker_count = 2, .minor_cycles = 1});
+        root = nullptr;
+        handshake_until(root, [&]() {
+            return rooted_destroyed.load(Ordering::RELAXED) >= ROOTED;
+        });
+        assert(rooted_destroyed.load(Ordering::RELAXED) == ROOTED);
+        collector_configure({});
+        
+    };
+    
+    define_test("gc_pacing") {
+        
+        using namespace gc;
+        
+        Atomic<size_t>& garbage_destroyed = counted_destroyed[6];
+        Atomic<size_t>& stalled_destroyed = counted_destroyed[7];
+        constexpr size_t GARBAGE = 1 << 16;
+        auto make_garbage = [](int tag) {
+            for (size_t i = 0; i != GARBAGE; ++i)
+                (void) new CountedNode(tag);
+        };
+        // Handshake, without allocating, for a while
+        auto handshake_for = [](std::chrono::milliseconds duration) {
+            auto deadline = std::chrono::steady_clock::now() + duration;
+            while (std::chrono::steady_clock::now() < deadline) {
+                mutator_handshake();
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        };
+        
+        // Under the soft limit, the collector finishes its cycle and sleeps,
+        // and the garbage made after that survives
+        collector_configure({.soft_limit = (size_t)collector_heap_bytes() + ((size_t)1 << 30)});
+        make_garbage(6);
+        handshake_for(std::chrono::milliseconds(200));
+        size_t before = garbage_destroyed.load(Ordering::RELAXED);
+        make_garbage(6);
+        handshake_for(std::chrono::milliseconds(100));
+        assert(garbage_destroyed.load(Ordering::RELAXED) == before);
+        
+        // Allocating past the soft limit wakes it
+        collector_configure({.soft_limit = (size_t)collector_heap_bytes() + ((size_t)1 << 20)});
+        make_garbage(6);
+        handshake_until(nullptr, [&]() {
+            return garbage_destroyed.load(Ordering::RELAXED) >= 3 * GARBAGE;
+        });
+        assert(garbage_destroyed.load(Ordering::RELAXED) == 3 * GARBAGE);
+        
+        // Over the hard limit, each handshake helps and then waits for the
+        // collector, which must wake for it even under the soft limit
+        collector_configure({
+            .lazy_sweep = true,
+            .soft_limit = (size_t)1 << 40,
+            .hard_limit = 1,
+        });
+        make_garbage(7);
+        handshake_until(nullptr, [&]() {
+            return stalled_destroyed.load(Ordering::RELAXED) >= GARBAGE;
+        });
+        assert(stalled_destroyed.load(Ordering::RELAXED) == GARBAGE);
+        collector_configure({});
+        
+    };
+    
+    define_test("gc_telemetry") {
+        
+        using namespace gc;
+        
+        // Cycles count and time themselves, and, when tracing, record their
+        // phases and each mutator's handshakes as trace events
+        collector_trace(true);
+        collector_statistics before = collector_stats_total();
+        constexpr size_t ROOTED = 1 << 10;
+        constexpr size_t GARBAGE = 1 << 12;
+        std::vector<TestNode*> rooted(ROOTED);
+        for (size_t i = 0; i != ROOTED; ++i) {
+            rooted[i] = new TestNode;
+            if (i)
+                rooted[(i - 1) / 2]->children[(i - 1) % 2] = rooted[i];
+        }
+        const TestNode* root = rooted[0];
+        for (size_t i = 0; i != GARBAGE; ++i)
+            (void) new TestObject;
+        handshake_until(root, [&]() {
+            collector_statistics total = collector_stats_total();
+            return (total.cycles >= before.cycles + 3) && (total.freed >= before.freed + GARBAGE);
+        });
+        collector_trace(false);
+        collector_statistics last = collector_stats();
+        collector_statistics total = collector_stats_total();
+        assert(last.cycles == 1);
+        assert(last.live >= ROOTED);
+        assert(last.rounds >= 1);
+        // at least we and the collector answer every round of handshakes
+        assert(last.handshakes >= 2 * (2 + last.rounds));
+        assert(last.handshake_max_ns <= last.synchronize_ns);
+        assert(last.mark_ns + last.sweep_ns + last.synchronize_ns <= last.cycle_ns);
+        assert(total.rounds >= total.cycles);
+        assert(total.bytes_allocated - before.bytes_allocated >= GARBAGE * sizeof(TestObject));
+        assert(total.handshake_max_ns >= last.handshake_max_ns);
+        
+        FILE* file = tmpfile();
+        collector_trace_dump(file);
+        rewind(file);
+        std::string trace;
+        for (int c; (c = fgetc(file)) != EOF;)
+            trace.push_back((char)c);
+        fclose(file);
+        assert(trace.starts_with("["));
+        for (const char* name : { "\"cycle\"", "\"mark\"", "\"sweep\"", "\"handshake\"" })
+            assert(trace.find(name) != std::string::npos);
+        
+    };
+    
+} // namespace aaa
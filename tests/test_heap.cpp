@@ -0,0 +1,168 @@
+//
+//  test_heap.cpp
+//  aaa
+//
+//  Created by Antony Searle on 24/1/2025.
+//
+
+#include <cassert>
+#include <cstdint>
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#include "heap.hpp"
+#include "test.hpp"
+
+namespace aaa {
+    
+    define_test("gc_heap") {
+        
+        using namespace gc;
+        
+        // trie node sizes get pages of their size class, come zeroed, and are
+        // aligned as their size requires
+        {
+            std::vector<void*> blocks;
+            for (size_t k = 1; k != 65; ++k) {
+                size_t n = 40 + 8 * k;
+                unsigned char* a = (unsigned char*)heap_allocate(n);
+                unsigned char* b = (unsigned char*)heap_allocate(n);
+                assert(std::all_of(a, a + n, [](unsigned char c) { return c == 0; }));
+                assert(!((uintptr_t)a % 8) && !((uintptr_t)b % 8));
+                if (!(n % 16))
+                    assert(!((uintptr_t)a % 16));
+                assert(_heap_page_of(a)->block_size == n);
+                assert(_heap_page_of(b)->block_size == n);
+                std::fill(a, a + n, 0xFF);
+                blocks.push_back(a);
+                blocks.push_back(b);
+            }
+            // the owner reuses its own frees at once, zeroed again
+            void* a = blocks.back();
+            heap_deallocate(a);
+            unsigned char* b = (unsigned char*)heap_allocate(40 + 8 * 64);
+            assert(b == a);
+            assert(std::all_of(b, b + 40 + 8 * 64, [](unsigned char c) { return c == 0; }));
+            for (void* p : blocks)
+                heap_deallocate(p);
+        }
+        
+        // large objects get pages of their own
+        {
+            uint64_t before = heap_stats().large_objects;
+            unsigned char* a = (unsigned char*)heap_allocate(1 << 20);
+            assert(heap_stats().large_objects == before + 1);
+            assert(_heap_page_of(a)->size_class == HEAP_SIZE_CLASSES);
+            assert(_heap_page_of(a + (1 << 20) - 1) != _heap_page_of(a));
+            assert(!a[0] && !a[(1 << 20) - 1]);
+            heap_deallocate(a);
+            assert(heap_stats().large_objects == before);
+        }
+        
+        // blocks freed by another thread, as the collector frees them, are
+        // reclaimed a whole page at a time, or offered for reuse
+        {
+            constexpr size_t N = 1000;
+            constexpr size_t COUNT = 4096;
+            std::vector<void*> blocks(COUNT);
+            std::thread([&]() {
+                for (void*& p : blocks)
+                    p = heap_allocate(N);
+                heap_flush();
+            }).join();
+            std::vector<_heap_page_t*> pages;
+            for (void* p : blocks)
+                pages.push_back(_heap_page_of(p));
+            std::sort(pages.begin(), pages.end());
+            pages.erase(std::unique(pages.begin(), pages.end()), pages.end());
+            assert(pages.size() > 2);
+            
+            // keep one block alive on the last page
+            void* survivor = blocks.back();
+            blocks.pop_back();
+            uint64_t released = heap_stats().pages_released;
+            for (void* p : blocks)
+                heap_deallocate(p);
+            heap_sweep_pages();
+            assert(heap_stats().pages_released >= released + pages.size() - 1);
+            
+            // the survivor's page has room again, and is the one drawn next
+            void* reused = nullptr;
+            std::thread([&]() {
+                reused = heap_allocate(N);
+                heap_flush();
+            }).join();
+            assert(_heap_page_of(reused) == _heap_page_of(survivor));
+            heap_deallocate(reused);
+            heap_deallocate(survivor);
+            released = heap_stats().pages_released;
+            heap_sweep_pages();
+            assert(heap_stats().pages_released >= released + 1);
+        }
+        
+        // logged blocks are handed over as one extent per page touched, and
+        // the logs wrap around as their pages' blocks are freed and reused
+        std::thread([]() {
+            std::vector<heap_extent> extents;
+            auto publish = [&]() {
+                extents.clear();
+                heap_publish_log([&](const heap_extent& extent) {
+                    extents.push_back(extent);
+                });
+                std::vector<void*> blocks;
+                for (const heap_extent& extent : extents)
+                    heap_extent_for_each(extent, [&](void* q) {
+                        blocks.push_back(q);
+                    });
+                std::sort(blocks.begin(), blocks.end());
+                return blocks;
+            };
+            assert(publish().empty());
+            std::vector<void*> expected;
+            for (size_t i = 0; i != 3000; ++i) {
+                void* q = heap_allocate(16 + 8 * (i % 3));
+                heap_log(q);
+                expected.push_back(q);
+            }
+            // unlogged blocks are not handed over
+            void* unlogged = heap_allocate(16);
+            void* large = heap_allocate(1 << 20);
+            heap_log(large);
+            expected.push_back(large);
+            std::sort(expected.begin(), expected.end());
+            assert(publish() == expected);
+            std::vector<_heap_page_t*> pages;
+            for (void* q : expected)
+                pages.push_back(_heap_page_of(q));
+            std::sort(pages.begin(), pages.end());
+            pages.erase(std::unique(pages.begin(), pages.end()), pages.end());
+            assert(extents.size() == pages.size());
+            assert(publish().empty());
+            for (void* q : expected)
+                heap_deallocate(q);
+            heap_deallocate(unlogged);
+            void* first = heap_allocate(40);
+            _heap_page_t* page = _heap_page_of(first);
+            heap_deallocate(first);
+            size_t n = page->log_capacity / 3 + 1;
+            for (int round = 0; round != 8; ++round) {
+                expected.clear();
+                for (size_t i = 0; i != n; ++i) {
+                    void* q = heap_allocate(40);
+                    heap_log(q);
+                    expected.push_back(q);
+                }
+                std::sort(expected.begin(), expected.end());
+                assert(publish() == expected);
+                for (void* q : expected)
+                    heap_deallocate(q);
+            }
+            assert(page->log_first != 0);
+            heap_flush();
+        }).join();
+        
+    };
+    
+} // namespace aaa
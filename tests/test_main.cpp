@@ -0,0 +1,95 @@
+//
+//  test_main.cpp
+//  aaa
+//
+//  Created by Antony Searle on 22/1/2025.
+//
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+
+#include "allocator.hpp"
+#include "gc.hpp"
+#include "heap.hpp"
+#include "object.hpp"
+#include "skiplist.hpp"
+#include "test.hpp"
+#include "thread_pool.hpp"
+
+// usage: aaa_tests [name...]
+//
+// Runs the named tests, or all of them if none are named.  A failing test
+// aborts.
+
+int main(int argc, char** argv) {
+    
+    using namespace aaa;
+    
+    // start the garbage collector thread
+    gc::collector_start();
+    
+    arena_initialize(); // thread-local bump allocator
+    thread_local_random_number_generator = new std::ranlux24_base;
+    
+    // get permission to start allocating gc::Objects
+    gc::mutator_enter();
+    
+    int count = 0;
+    {
+        thread_pool pool{3};
+        test::pool = &pool;
+        for (test::Test* p = test::registry_head; p; p = p->next) {
+            bool selected = (argc == 1);
+            for (int i = 1; i != argc; ++i)
+                selected = selected || !strcmp(argv[i], p->name);
+            if (selected) {
+                fprintf(stderr, "test %s\n", p->name);
+                p->function();
+                ++count;
+                // The test's roots are gone, so answer the collector, which
+                // cannot finish a cycle while we run tests without doing so
+                gc::mutator_handshake();
+            }
+        }
+        test::pool = nullptr;
+    }
+    
+    gc::mutator_leave();
+    arena_finalize();
+    
+    gc::collector_stop();
+    
+    // The collector deletes every object as it stops, leaving an empty
+    // heap, and can start again.  This test needs the collector that the
+    // others run under, so it runs here rather than from the registry
+    bool selected = (argc == 1);
+    for (int i = 1; i != argc; ++i)
+        selected = selected || !strcmp(argv[i], "collector_restart");
+    if (selected) {
+        fprintf(stderr, "test collector_restart\n");
+        struct Leaf : gc::Object {
+            virtual void _object_scan() const override {}
+        };
+        for (int restart = 0; restart != 2; ++restart) {
+            gc::heap_statistics stats = gc::heap_stats();
+            assert(!stats.pages && !stats.reserve_pages && !stats.large_objects);
+            gc::collector_start();
+            gc::mutator_enter();
+            const Leaf* root = new Leaf;
+            for (int i = 0; i != 1 << 16; ++i) {
+                (void) new Leaf;
+                gc::mutator_handshake();
+                gc::object_shade(root);
+            }
+            gc::mutator_leave();
+            gc::collector_stop();
+        }
+        ++count;
+    }
+    
+    fprintf(stderr, "%d tests passed\n", count);
+    
+}
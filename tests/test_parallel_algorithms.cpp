@@ -0,0 +1,279 @@
+//
+//  test_parallel_algorithms.cpp
+//  aaa
+//
+//  Created by Antony Searle on 22/1/2025.
+//
+
+#include <random>
+
+#include "parallel_algorithms.hpp"
+#include "test.hpp"
+#include "thread_pool.hpp"
+
+namespace aaa {
+    
+    define_test("parallel_merge_right") {
+        
+        uint64_t N = 1000000;
+        uint64_t M = 10000; // <-- sparseifier
+        PersistentIntMap<uint64_t> a;
+        PersistentIntMap<uint64_t> b;
+        PersistentIntMap<uint64_t> c;
+        
+        concurrent_skiplist_map<uint64_t, uint64_t> z;
+        frozen_skiplist_map<uint64_t, uint64_t> y;
+        
+        
+        {
+            std::mt19937 prng{std::random_device{}()};
+            std::uniform_int_distribution<uint64_t> p{0, N-1};
+            
+            for (uint64_t i = 0; i != M; ++i) {
+                uint64_t j = p(prng);
+                uint64_t k = p(prng);
+                a.insert_or_replace(j, k);
+                b.insert_or_replace(k, j);
+            }
+            
+            // copy a into z
+            for (uint64_t key = 0; key != N; ++key) {
+                uint64_t value_a = 0;
+                bool flag_a = a.try_find(key, value_a);
+                if (flag_a)
+                    z.emplace(key, value_a);
+            }
+            
+            
+            a._root->assert_invariant();
+            b._root->assert_invariant();
+            
+            c = merge_left(a, b);
+            
+            y = std::move(z).freeze();
+            
+            // validate
+            for (uint64_t key = 0; key != N; ++key) {
+                uint64_t value_a = 0;
+                uint64_t value_b = 0;
+                uint64_t value_c = 0;
+                bool flag_a = a.try_find(key, value_a);
+                bool flag_b = b.try_find(key, value_b);
+                bool flag_c = c.try_find(key, value_c);
+                auto it_y = y.find(key);
+                if (flag_a) {
+                    assert(flag_c);
+                }
+                if (flag_b) {
+                    assert(flag_c);
+                }
+                if (flag_c) {
+                    if (!flag_a) {
+                        assert(flag_b);
+                        assert(value_c == value_b);
+                    } else {
+                        assert(value_c == value_a);
+                    }
+                    
+                }
+                assert(!!it_y == flag_a);
+                if (it_y) {
+                    assert(it_y->second == value_a);
+                }
+                
+            }
+            
+        }
+        
+        PersistentIntMap<uint64_t> d;
+        test::pool->block_on([&](latch& inner) {
+            parallel_merge_right<uint64_t>(inner, b, y, d);
+        });
+        
+        
+        {
+            
+            // validate the parallel merge is the same as the serial merge
+            for (uint64_t key = 0; key != N; ++key) {
+                uint64_t value_a = 0;
+                uint64_t value_b = 0;
+                uint64_t value_c = 0;
+                uint64_t value_d = 0;
+                uint64_t value_y = 0;
+                bool flag_a = a.try_find(key, value_a);
+                bool flag_b = b.try_find(key, value_b);
+                bool flag_c = c.try_find(key, value_c);
+                bool flag_d = d.try_find(key, value_d);
+                auto it_y = y.find(key);
+                bool flag_y = it_y && (it_y->first == key);
+                if (flag_y) value_y = it_y->second;
+                bool f = flag_a || flag_b || flag_c || flag_d || flag_y;
+                //                if (f) printf("%llx :", key);
+                //                if (flag_a) printf(" (a : %llx),", value_a);
+                //                if (flag_b) printf(" (b : %llx),", value_b);
+                //                if (flag_c) printf(" (c : %llx),", value_c);
+                //                if (flag_d) printf(" (d : %llx),", value_d);
+                //                if (flag_y) printf(" (y : %llx),", value_y);
+                //                if (f) printf("\n");
+                assert(flag_c == flag_d);
+                if (flag_d) {
+                    assert(value_c == value_d);
+                }
+            }
+            
+        }
+        
+        // the same again, spawning every subproblem, and with the serial
+        // algorithm taking over at various grain sizes; merging into an
+        // empty trie just persists the skiplist, which should reproduce a
+        for (execution_policy policy : {execution_policy::spawn(),
+                                        execution_policy{.serial_shift = 6},
+                                        execution_policy{.serial_shift = 60}}) {
+            PersistentIntMap<uint64_t> e;
+            PersistentIntMap<uint64_t> g;
+            test::pool->block_on([&](latch& inner) {
+                parallel_merge_right<uint64_t>(inner, b, y, e, policy);
+                parallel_merge_right<uint64_t>(inner, PersistentIntMap<uint64_t>{}, y, g, policy);
+            });
+            for (uint64_t key = 0; key != N; ++key) {
+                uint64_t value_a = 0;
+                uint64_t value_d = 0;
+                uint64_t value_e = 0;
+                uint64_t value_g = 0;
+                bool flag_a = a.try_find(key, value_a);
+                bool flag_d = d.try_find(key, value_d);
+                bool flag_e = e.try_find(key, value_e);
+                bool flag_g = g.try_find(key, value_g);
+                assert(flag_d == flag_e);
+                assert(value_d == value_e);
+                assert(flag_a == flag_g);
+                assert(value_a == value_g);
+            }
+        }
+        
+    };
+    
+    define_test("parallel_merge_left") {
+        
+        // a sparse map, and a dense one that is a single leaf, so that
+        // merging them in either order adopts down through every level
+        uint64_t N = 1000000;
+        PersistentIntMap<uint64_t> a;
+        PersistentIntMap<uint64_t> b;
+        std::mt19937 prng{std::random_device{}()};
+        std::uniform_int_distribution<uint64_t> p{0, N-1};
+        for (uint64_t i = 0; i != 10000; ++i)
+            a.insert_or_replace(p(prng), i);
+        for (uint64_t key = 0x7A000; key != 0x7A040; ++key)
+            b.insert_or_replace(key, key);
+        
+        for (execution_policy policy : {execution_policy::spawn(),
+                                        execution_policy{.serial_shift = -1},
+                                        execution_policy{.serial_shift = 6}}) {
+            for (int order = 0; order != 2; ++order) {
+                const PersistentIntMap<uint64_t>& x = order ? b : a;
+                const PersistentIntMap<uint64_t>& y = order ? a : b;
+                PersistentIntMap<uint64_t> c = merge_left(x, y);
+                PersistentIntMap<uint64_t> d;
+                test::pool->block_on([&](latch& inner) {
+                    parallel_merge_left<uint64_t>(inner, x._root, y._root, &d._root, policy);
+                });
+                d._root->assert_invariant();
+                for (uint64_t key = 0; key != N; ++key) {
+                    uint64_t value_c = 0;
+                    uint64_t value_d = 0;
+                    bool flag_c = c.try_find(key, value_c);
+                    bool flag_d = d.try_find(key, value_d);
+                    assert(flag_c == flag_d);
+                    assert(value_c == value_d);
+                }
+            }
+        }
+        
+    };
+    
+    
+    define_test("parallel_persist_generate") {
+        
+        uint64_t N = 1000000;
+        PersistentIntMap<uint64_t> a;
+        auto f = [](uint64_t key) { return key * key; };
+        test::pool->block_on([&](latch& inner) {
+            parallel_persist_generate_outer<uint64_t>(inner, &a, 0, N - 1, f);
+        });
+        a._root->assert_invariant();
+        for (uint64_t key = 0; key != N; ++key) {
+            uint64_t value = 0;
+            bool flag = a.try_find(key, value);
+            assert(flag);
+            assert(value == key * key);
+        }
+        uint64_t value = 0;
+        assert(!a.try_find(N, value));
+        
+        // with the serial algorithm below the grain size
+        PersistentIntMap<uint64_t> b;
+        test::pool->block_on([&](latch& inner) {
+            parallel_persist_generate_outer<uint64_t>(inner, &b, 0, N - 1, f, execution_policy{.serial_shift = 12});
+        });
+        b._root->assert_invariant();
+        for (uint64_t key = 0; key != N; ++key) {
+            uint64_t value = 0;
+            bool flag = b.try_find(key, value);
+            assert(flag);
+            assert(value == key * key);
+        }
+        
+    };
+    
+    define_test("fork_merge_left") {
+        
+        uint64_t N = 1000000;
+        uint64_t M = 100000;
+        PersistentIntMap<uint64_t> a;
+        PersistentIntMap<uint64_t> b;
+        std::mt19937 prng{std::random_device{}()};
+        std::uniform_int_distribution<uint64_t> p{0, N-1};
+        for (uint64_t i = 0; i != M; ++i) {
+            a.insert_or_replace(p(prng), i);
+            b.insert_or_replace(p(prng), i + M);
+        }
+        
+        PersistentIntMap<uint64_t> c = merge_left(a, b);
+        PersistentIntMap<uint64_t> d;
+        test::pool->block_on([&](latch& inner) {
+            fork_root(inner, fork_merge_left<uint64_t>(a._root, b._root, &d._root));
+        });
+        d._root->assert_invariant();
+        for (uint64_t key = 0; key != N; ++key) {
+            uint64_t value_c = 0;
+            uint64_t value_d = 0;
+            bool flag_c = c.try_find(key, value_c);
+            bool flag_d = d.try_find(key, value_d);
+            assert(flag_c == flag_d);
+            assert(value_c == value_d);
+        }
+        
+    };
+    
+    define_test("fork_persist_generate") {
+        
+        uint64_t N = 1000000;
+        PersistentIntMap<uint64_t> a;
+        auto f = [](uint64_t key) { return key * key; };
+        test::pool->block_on([&](latch& inner) {
+            fork_root(inner, fork_persist_generate<uint64_t>(&a._root, 0, N - 1, f));
+        });
+        a._root->assert_invariant();
+        for (uint64_t key = 0; key != N; ++key) {
+            uint64_t value = 0;
+            bool flag = a.try_find(key, value);
+            assert(flag);
+            assert(value == key * key);
+        }
+        uint64_t value = 0;
+        assert(!a.try_find(N, value));
+        
+    };
+    
+} // namespace aaa
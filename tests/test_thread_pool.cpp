@@ -0,0 +1,94 @@
+//
+//  test_thread_pool.cpp
+//  aaa
+//
+//  Created by Antony Searle on 22/1/2025.
+//
+
+#include <cassert>
+
+#include <chrono>
+#include <thread>
+
+#include "allocator.hpp"
+#include "atomic.hpp"
+#include "latch.hpp"
+#include "test.hpp"
+#include "thread_pool.hpp"
+
+namespace aaa {
+    
+    namespace {
+        
+        latch::signalling_coroutine noop(latch& outer) {
+            co_return;
+        }
+        
+        latch::signalling_coroutine burst(latch& outer, long count) {
+            latch inner;
+            for (long i = 0; i != count; ++i)
+                noop(inner);
+            co_await inner;
+        }
+        
+        // as burst, noting the arena footprint of the thread that spawned
+        // the children
+        latch::signalling_coroutine burst_reserved(latch& outer, long count, Atomic<size_t>& high) {
+            latch inner;
+            for (long i = 0; i != count; ++i)
+                noop(inner);
+            high.max_fetch(arena_reserved(), Ordering::RELAXED);
+            co_await inner;
+        }
+        
+    } // namespace
+    
+    define_test("thread_pool_burst_reclaim") {
+        
+        // A burst spills one worker's queue into an overflow grown to hold
+        // most of the children; once the pool goes idle again, every
+        // overflow should be back to its initial capacity
+        test::pool->block_on([](latch& inner) {
+            burst(inner, 1 << 17);
+        });
+        
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        for (;;) {
+            bool baseline = true;
+            for (int i = 0; i != test::pool->queue_count(); ++i) {
+                const auto* array = test::pool->_workers[i].queue._overflow._array.load(std::memory_order_acquire);
+                baseline = baseline && (array->capacity() == thread_pool::queue_type::overflow_type::INITIAL_CAPACITY);
+            }
+            if (baseline)
+                break;
+            assert(std::chrono::steady_clock::now() < deadline);
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        
+    };
+    
+    define_test("thread_pool_end_frame") {
+        
+        // Each frame bump-allocates more coroutine frames than the initial
+        // slab holds.  Without a rewind the arenas would grow every frame;
+        // once the largest slab fits a frame, ending each frame should keep
+        // every thread's footprint where it is
+        constexpr long count = 1 << 14;
+        Atomic<size_t> high{0};
+        auto frame = [&]() {
+            test::pool->block_on([&](latch& inner) {
+                burst_reserved(inner, count, high);
+            });
+            test::pool->end_frame();
+            high.max_fetch(arena_reserved(), Ordering::RELAXED);
+        };
+        for (int i = 0; i != 8; ++i)
+            frame();
+        size_t warm = high.load(Ordering::RELAXED);
+        for (int i = 0; i != 256; ++i)
+            frame();
+        assert(high.load(Ordering::RELAXED) == warm);
+        
+    };
+    
+} // namespace aaa
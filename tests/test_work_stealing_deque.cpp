@@ -0,0 +1,175 @@
+//
+//  test_work_stealing_deque.cpp
+//  aaa
+//
+//  Created by Antony Searle on 22/1/2025.
+//
+
+#include <cassert>
+
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "allocator.hpp"
+#include "atomic.hpp"
+#include "gc.hpp"
+#include "test.hpp"
+#include "work_stealing_deque.hpp"
+
+namespace aaa {
+    
+    namespace {
+        
+        // The owner pushes and pops while thieves steal_half; every item must
+        // be consumed exactly once
+        template<typename Deque>
+        void check_exactly_once() {
+            constexpr intptr_t N = 1 << 18;
+            constexpr int THIEVES = 3;
+            Deque victim;
+            std::unique_ptr<Atomic<uint32_t>[]> seen{new Atomic<uint32_t>[N]};
+            for (intptr_t i = 0; i != N; ++i)
+                seen[i].store(0, Ordering::RELAXED);
+            Atomic<uint32_t> done{0};
+            std::vector<std::thread> thieves;
+            for (int t = 0; t != THIEVES; ++t) {
+                thieves.emplace_back([&]() {
+                    arena_initialize();
+                    gc::mutator_enter();
+                    {
+                        std::unique_ptr<Deque> own{new Deque};
+                        intptr_t item = 0;
+                        for (;;) {
+                            if (own->pop(item) || victim.steal_half(item, *own)) {
+                                seen[item].add_fetch(1, Ordering::RELAXED);
+                                continue;
+                            }
+                            if (done.load(Ordering::ACQUIRE) && !victim.can_steal())
+                                break;
+                            std::this_thread::yield();
+                        }
+                    }
+                    gc::mutator_exit();
+                    arena_finalize();
+                });
+            }
+            intptr_t item = 0;
+            for (intptr_t i = 0; i != N; ++i) {
+                victim.push(i);
+                if ((i % 3 == 0) && victim.pop(item))
+                    seen[item].add_fetch(1, Ordering::RELAXED);
+            }
+            while (victim.pop(item))
+                seen[item].add_fetch(1, Ordering::RELAXED);
+            done.store(1, Ordering::RELEASE);
+            for (auto& t : thieves)
+                t.join();
+            for (intptr_t i = 0; i != N; ++i)
+                assert(seen[i].load(Ordering::RELAXED) == 1);
+        }
+        
+    } // namespace
+    
+    define_test("work_stealing_deque") {
+        
+        // single-threaded, pop is LIFO
+        {
+            work_stealing_deque<intptr_t> a;
+            intptr_t item = -1;
+            assert(!a.pop(item));
+            for (intptr_t i = 0; i != 100; ++i)
+                a.push(i);
+            for (intptr_t i = 99; i != -1; --i) {
+                assert(a.pop(item));
+                assert(item == i);
+            }
+            assert(!a.pop(item));
+            assert(!a.can_steal());
+            // including after a thief takes from the other end
+            for (intptr_t i = 0; i != 4; ++i)
+                a.push(i);
+            assert(a.steal(item) && (item == 0));
+            for (intptr_t i = 3; i != 0; --i)
+                assert(a.pop(item) && (item == i));
+            assert(!a.pop(item));
+        }
+        
+        // steal_half takes the oldest and moves a batch to the thief
+        {
+            work_stealing_deque<intptr_t> a;
+            work_stealing_deque<intptr_t> b;
+            for (intptr_t i = 0; i != 6; ++i)
+                a.push(i);
+            intptr_t item = -1;
+            assert(a.steal_half(item, b) == 3);
+            assert(item == 0);
+            assert(b.pop(item) && (item == 2));
+            assert(b.pop(item) && (item == 1));
+            assert(!b.pop(item));
+            assert(a.steal(item) && (item == 3));
+        }
+        
+        // a drained deque shrinks back to its initial capacity, retiring
+        // the arrays it outgrew
+        {
+            using deque_type = work_stealing_deque<intptr_t>;
+            deque_type a;
+            for (intptr_t i = 0; i != 1000; ++i)
+                a.push(i);
+            assert(a._array.load(std::memory_order_relaxed)->capacity() == 1024);
+            intptr_t item = -1;
+            for (intptr_t i = 0; i != 900; ++i)
+                assert(a.pop(item));
+            a.shrink();
+            assert(a._array.load(std::memory_order_relaxed)->capacity() == 256);
+            for (intptr_t i = 0; i != 100; ++i)
+                assert(a.pop(item));
+            a.shrink();
+            assert(a._array.load(std::memory_order_relaxed)->capacity() == deque_type::INITIAL_CAPACITY);
+            const deque_type::circular_array* retired = a.take_retired();
+            int count = 0;
+            for (const deque_type::circular_array* p = retired; p; p = p->_next_retired)
+                ++count;
+            assert(count == 8); // 16, 32, ..., 1024 replaced
+            deque_type::free_retired(retired);
+            assert(!a.take_retired());
+        }
+        
+        check_exactly_once<work_stealing_deque<intptr_t>>();
+        
+    };
+    
+    define_test("bounded_work_stealing_deque") {
+        
+        // pushes beyond the inline capacity spill, and the owner pops the
+        // spilled items first while thieves take the inline ones first
+        {
+            using deque_type = bounded_work_stealing_deque<intptr_t, 16>;
+            deque_type a;
+            deque_type b;
+            for (intptr_t i = 0; i != 40; ++i)
+                a.push(i);
+            assert(a._spilled);
+            intptr_t item = -1;
+            assert(a.pop(item) && (item == 39));
+            assert(a.steal(item) && (item == 0));
+            assert(a.steal_half(item, b) == 8);
+            assert(item == 1);
+            for (intptr_t i = 38; i != 8; --i) {
+                assert(a.pop(item));
+                assert(item == i);
+            }
+            assert(!a.pop(item));
+            assert(!a._spilled);
+            assert(!a.can_steal());
+            for (intptr_t i = 8; i != 1; --i)
+                assert(b.pop(item) && (item == i));
+            assert(!b.pop(item));
+        }
+        
+        check_exactly_once<bounded_work_stealing_deque<intptr_t, 16>>();
+        
+    };
+    
+} // namespace aaa